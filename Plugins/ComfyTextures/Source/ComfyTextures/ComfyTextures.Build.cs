@@ -51,6 +51,9 @@ public class ComfyTextures : ModuleRules
 			);
 		
 		
+		// deflate for the streaming PNG writer
+		AddEngineThirdPartyPrivateStaticDependencies(Target, "zlib");
+
 		DynamicallyLoadedModuleNames.AddRange(
 			new string[]
 			{
@@ -0,0 +1,114 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "ComfyTexturesDepthPyramid.h"
+#include "ComfyTexturesWidgetBase.h"
+
+ComfyTexturesDepthPyramid::ComfyTexturesDepthPyramid(const FComfyTexturesImageData& RawDepth) :
+  Width(RawDepth.Width), Height(RawDepth.Height)
+{
+  if (Width <= 0 || Height <= 0 || RawDepth.Pixels.Num() != Width * Height)
+  {
+    Width = 0;
+    Height = 0;
+    return;
+  }
+
+  Depth.SetNumUninitialized(Width * Height);
+  for (int Index = 0; Index < Depth.Num(); Index++)
+  {
+    Depth[Index] = RawDepth.Pixels[Index].R;
+  }
+
+  // odd sizes round up, the last block of a row or column reads its remaining pixel twice
+  int SourceWidth = Width;
+  int SourceHeight = Height;
+
+  while (SourceWidth > 1 || SourceHeight > 1)
+  {
+    FLevel& Level = Levels.AddDefaulted_GetRef();
+    Level.Width = FMath::DivideAndRoundUp(SourceWidth, 2);
+    Level.Height = FMath::DivideAndRoundUp(SourceHeight, 2);
+    Level.MinMax.SetNumUninitialized(Level.Width * Level.Height);
+
+    const FLevel* Source = Levels.Num() > 1 ? &Levels[Levels.Num() - 2] : nullptr;
+
+    for (int Y = 0; Y < Level.Height; Y++)
+    {
+      int Y0 = Y * 2;
+      int Y1 = FMath::Min(Y0 + 1, SourceHeight - 1);
+
+      for (int X = 0; X < Level.Width; X++)
+      {
+        int X0 = X * 2;
+        int X1 = FMath::Min(X0 + 1, SourceWidth - 1);
+
+        int Indices[4] = { Y0 * SourceWidth + X0, Y0 * SourceWidth + X1, Y1 * SourceWidth + X0, Y1 * SourceWidth + X1 };
+        FVector2f MinMax(FLT_MAX, -FLT_MAX);
+
+        for (int Index : Indices)
+        {
+          FVector2f Range = Source != nullptr ? Source->MinMax[Index] : FVector2f(Depth[Index], Depth[Index]);
+          MinMax.X = FMath::Min(MinMax.X, Range.X);
+          MinMax.Y = FMath::Max(MinMax.Y, Range.Y);
+        }
+
+        Level.MinMax[Y * Level.Width + X] = MinMax;
+      }
+    }
+
+    SourceWidth = Level.Width;
+    SourceHeight = Level.Height;
+  }
+}
+
+void ComfyTexturesDepthPyramid::GetDepthRange(int MinX, int MinY, int MaxX, int MaxY, float& OutMin, float& OutMax) const
+{
+  OutMin = FLT_MAX;
+  OutMax = -FLT_MAX;
+
+  if (Width <= 0 || Height <= 0)
+  {
+    return;
+  }
+
+  MinX = FMath::Clamp(MinX, 0, Width - 1);
+  MinY = FMath::Clamp(MinY, 0, Height - 1);
+  MaxX = FMath::Clamp(MaxX, MinX, Width - 1);
+  MaxY = FMath::Clamp(MaxY, MinY, Height - 1);
+
+  // small rectangles are read directly
+  if (MaxX - MinX <= 1 && MaxY - MinY <= 1)
+  {
+    for (int Y = MinY; Y <= MaxY; Y++)
+    {
+      for (int X = MinX; X <= MaxX; X++)
+      {
+        OutMin = FMath::Min(OutMin, GetDepth(X, Y));
+        OutMax = FMath::Max(OutMax, GetDepth(X, Y));
+      }
+    }
+
+    return;
+  }
+
+  // the first level where the rectangle touches at most two blocks in each direction
+  int LevelIndex = 0;
+  while (LevelIndex < Levels.Num() - 1 && (((MaxX >> (LevelIndex + 1)) - (MinX >> (LevelIndex + 1)) > 1) || ((MaxY >> (LevelIndex + 1)) - (MinY >> (LevelIndex + 1)) > 1)))
+  {
+    LevelIndex++;
+  }
+
+  const FLevel& Level = Levels[LevelIndex];
+  int Shift = LevelIndex + 1;
+
+  for (int Y = MinY >> Shift; Y <= FMath::Min(MaxY >> Shift, Level.Height - 1); Y++)
+  {
+    for (int X = MinX >> Shift; X <= FMath::Min(MaxX >> Shift, Level.Width - 1); X++)
+    {
+      const FVector2f& Range = Level.MinMax[Y * Level.Width + X];
+      OutMin = FMath::Min(OutMin, Range.X);
+      OutMax = FMath::Max(OutMax, Range.Y);
+    }
+  }
+}
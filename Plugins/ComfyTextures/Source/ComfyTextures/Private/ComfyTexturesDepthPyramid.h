@@ -0,0 +1,45 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+struct FComfyTexturesImageData;
+
+/**
+ * Single channel copy of a raw depth capture with a min max pyramid for testing whole regions against the depth at once
+ */
+class ComfyTexturesDepthPyramid
+{
+public:
+	// reads the red channel of RawDepth and halves it level by level down to a single texel
+	explicit ComfyTexturesDepthPyramid(const FComfyTexturesImageData& RawDepth);
+
+	int GetWidth() const { return Width; }
+
+	int GetHeight() const { return Height; }
+
+	float GetDepth(int X, int Y) const { return Depth[Y * Width + X]; }
+
+	// minimum and maximum depth over the inclusive pixel rectangle, may include depths from around the rectangle
+	void GetDepthRange(int MinX, int MinY, int MaxX, int MaxY, float& OutMin, float& OutMax) const;
+
+private:
+	struct FLevel
+	{
+		TArray<FVector2f> MinMax;
+
+		int Width = 0;
+
+		int Height = 0;
+	};
+
+	int Width = 0;
+
+	int Height = 0;
+
+	TArray<float> Depth;
+
+	// level N covers blocks of 2^(N + 1) pixels
+	TArray<FLevel> Levels;
+};
@@ -260,7 +260,16 @@ bool ComfyTexturesHttpClient::DoHttpFileUpload(const FString& Url, const TArray6
   FString ContentDisposition = "Content-Disposition: form-data; name=\"image\"; filename=\"" + FileName + "\"";
   Content.Append((uint8*)TCHAR_TO_ANSI(*ContentDisposition), ContentDisposition.Len());
   Content.Append((uint8*)"\r\n", 2);
+  FString Extension = FPaths::GetExtension(FileName).ToLower();
   FString ContentType = "Content-Type: image/png";
+  if (Extension == "tga")
+  {
+    ContentType = "Content-Type: image/x-tga";
+  }
+  else if (Extension == "qoi")
+  {
+    ContentType = "Content-Type: image/qoi";
+  }
   Content.Append((uint8*)TCHAR_TO_ANSI(*ContentType), ContentType.Len());
   Content.Append((uint8*)"\r\n", 2);
   Content.Append((uint8*)"\r\n", 2);
@@ -0,0 +1,188 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "ComfyTexturesImageCodecs.h"
+#include "ComfyTexturesWidgetBase.h"
+
+bool ComfyTexturesImageCodecs::EncodeTga(int Width, int Height, int Channels, const uint8* Pixels, TArray64<uint8>& OutBytes)
+{
+  if (Width <= 0 || Height <= 0 || Width > MAX_uint16 || Height > MAX_uint16)
+  {
+    UE_LOG(LogComfyTextures, Error, TEXT("Invalid TGA size %dx%d"), Width, Height);
+    return false;
+  }
+
+  if (Channels != 1 && Channels != 3 && Channels != 4)
+  {
+    UE_LOG(LogComfyTextures, Error, TEXT("Unsupported TGA format with %d channels"), Channels);
+    return false;
+  }
+
+  int64 NumPixels = (int64)Width * Height;
+
+  OutBytes.SetNumUninitialized(18 + NumPixels * Channels);
+  uint8* Out = OutBytes.GetData();
+
+  // no image id or color map, true color or grayscale, top left origin
+  FMemory::Memzero(Out, 18);
+  Out[2] = Channels == 1 ? 3 : 2;
+  Out[12] = Width & 0xFF;
+  Out[13] = (Width >> 8) & 0xFF;
+  Out[14] = Height & 0xFF;
+  Out[15] = (Height >> 8) & 0xFF;
+  Out[16] = Channels * 8;
+  Out[17] = 0x20 | (Channels == 4 ? 8 : 0);
+  Out += 18;
+
+  if (Channels == 1)
+  {
+    FMemory::Memcpy(Out, Pixels, NumPixels);
+    return true;
+  }
+
+  // TGA stores color as BGR
+  for (int64 Index = 0; Index < NumPixels; Index++)
+  {
+    const uint8* Pixel = Pixels + Index * Channels;
+    uint8* OutPixel = Out + Index * Channels;
+
+    OutPixel[0] = Pixel[2];
+    OutPixel[1] = Pixel[1];
+    OutPixel[2] = Pixel[0];
+
+    if (Channels == 4)
+    {
+      OutPixel[3] = Pixel[3];
+    }
+  }
+
+  return true;
+}
+
+bool ComfyTexturesImageCodecs::EncodeQoi(int Width, int Height, int Channels, const uint8* Pixels, TArray64<uint8>& OutBytes)
+{
+  if (Width <= 0 || Height <= 0)
+  {
+    UE_LOG(LogComfyTextures, Error, TEXT("Invalid QOI size %dx%d"), Width, Height);
+    return false;
+  }
+
+  if (Channels != 1 && Channels != 3 && Channels != 4)
+  {
+    UE_LOG(LogComfyTextures, Error, TEXT("Unsupported QOI format with %d channels"), Channels);
+    return false;
+  }
+
+  int64 NumPixels = (int64)Width * Height;
+  int OutChannels = Channels == 4 ? 4 : 3;
+
+  // worst case is one tag byte per pixel plus the pixel, header and end marker
+  OutBytes.SetNumUninitialized(14 + NumPixels * (OutChannels + 1) + 8);
+  uint8* Out = OutBytes.GetData();
+  int64 Size = 0;
+
+  auto WriteBigEndian = [&Out, &Size](uint32 Value)
+    {
+      Out[Size++] = (Value >> 24) & 0xFF;
+      Out[Size++] = (Value >> 16) & 0xFF;
+      Out[Size++] = (Value >> 8) & 0xFF;
+      Out[Size++] = Value & 0xFF;
+    };
+
+  Out[Size++] = 'q';
+  Out[Size++] = 'o';
+  Out[Size++] = 'i';
+  Out[Size++] = 'f';
+  WriteBigEndian(Width);
+  WriteBigEndian(Height);
+  Out[Size++] = OutChannels;
+  Out[Size++] = 0;
+
+  FColor Index[64];
+  FMemory::Memzero(Index, sizeof(Index));
+
+  FColor Previous(0, 0, 0, 255);
+  int Run = 0;
+
+  for (int64 PixelIndex = 0; PixelIndex < NumPixels; PixelIndex++)
+  {
+    const uint8* Pixel = Pixels + PixelIndex * Channels;
+
+    FColor Current;
+    Current.R = Pixel[0];
+    Current.G = Channels == 1 ? Pixel[0] : Pixel[1];
+    Current.B = Channels == 1 ? Pixel[0] : Pixel[2];
+    Current.A = Channels == 4 ? Pixel[3] : 255;
+
+    if (Current == Previous)
+    {
+      Run++;
+      if (Run == 62 || PixelIndex == NumPixels - 1)
+      {
+        Out[Size++] = 0xC0 | (Run - 1);
+        Run = 0;
+      }
+      continue;
+    }
+
+    if (Run > 0)
+    {
+      Out[Size++] = 0xC0 | (Run - 1);
+      Run = 0;
+    }
+
+    int Hash = (Current.R * 3 + Current.G * 5 + Current.B * 7 + Current.A * 11) % 64;
+
+    if (Index[Hash] == Current)
+    {
+      Out[Size++] = Hash;
+    }
+    else
+    {
+      Index[Hash] = Current;
+
+      if (Current.A == Previous.A)
+      {
+        int8 DiffR = (int8)(Current.R - Previous.R);
+        int8 DiffG = (int8)(Current.G - Previous.G);
+        int8 DiffB = (int8)(Current.B - Previous.B);
+        int8 DiffRG = DiffR - DiffG;
+        int8 DiffBG = DiffB - DiffG;
+
+        if (DiffR > -3 && DiffR < 2 && DiffG > -3 && DiffG < 2 && DiffB > -3 && DiffB < 2)
+        {
+          Out[Size++] = 0x40 | ((DiffR + 2) << 4) | ((DiffG + 2) << 2) | (DiffB + 2);
+        }
+        else if (DiffRG > -9 && DiffRG < 8 && DiffG > -33 && DiffG < 32 && DiffBG > -9 && DiffBG < 8)
+        {
+          Out[Size++] = 0x80 | (DiffG + 32);
+          Out[Size++] = ((DiffRG + 8) << 4) | (DiffBG + 8);
+        }
+        else
+        {
+          Out[Size++] = 0xFE;
+          Out[Size++] = Current.R;
+          Out[Size++] = Current.G;
+          Out[Size++] = Current.B;
+        }
+      }
+      else
+      {
+        Out[Size++] = 0xFF;
+        Out[Size++] = Current.R;
+        Out[Size++] = Current.G;
+        Out[Size++] = Current.B;
+        Out[Size++] = Current.A;
+      }
+    }
+
+    Previous = Current;
+  }
+
+  static const uint8 EndMarker[] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+  FMemory::Memcpy(Out + Size, EndMarker, sizeof(EndMarker));
+  Size += sizeof(EndMarker);
+
+  OutBytes.SetNum(Size);
+  return true;
+}
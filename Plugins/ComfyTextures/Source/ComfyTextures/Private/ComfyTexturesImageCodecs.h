@@ -0,0 +1,17 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Encoders for upload formats that trade file size for encode speed, both take 8 bit top to bottom rows
+ */
+namespace ComfyTexturesImageCodecs
+{
+	// uncompressed TGA, Channels is 1 for grayscale, 3 for RGB or 4 for RGBA
+	bool EncodeTga(int Width, int Height, int Channels, const uint8* Pixels, TArray64<uint8>& OutBytes);
+
+	// QOI, Channels is 1, 3 or 4, grayscale images are written as RGB
+	bool EncodeQoi(int Width, int Height, int Channels, const uint8* Pixels, TArray64<uint8>& OutBytes);
+}
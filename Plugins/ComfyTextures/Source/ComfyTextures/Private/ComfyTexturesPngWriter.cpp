@@ -0,0 +1,217 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "ComfyTexturesPngWriter.h"
+#include "ComfyTexturesWidgetBase.h"
+#include "Async/ParallelFor.h"
+
+THIRD_PARTY_INCLUDES_START
+#include "zlib.h"
+THIRD_PARTY_INCLUDES_END
+
+static const int PngIdatChunkSize = 64 * 1024;
+
+// uncompressed bytes per band, large enough for deflate to find most matches inside the band
+static const int PngBandSize = 256 * 1024;
+
+static void WriteBigEndian(uint8* Dest, uint32 Value)
+{
+  Dest[0] = (Value >> 24) & 0xFF;
+  Dest[1] = (Value >> 16) & 0xFF;
+  Dest[2] = (Value >> 8) & 0xFF;
+  Dest[3] = Value & 0xFF;
+}
+
+static int GetZlibLevel(EComfyTexturesPngCompression Compression)
+{
+  switch (Compression)
+  {
+  case EComfyTexturesPngCompression::Store:
+    return Z_NO_COMPRESSION;
+  case EComfyTexturesPngCompression::Fast:
+    return Z_BEST_SPEED;
+  default:
+    return Z_DEFAULT_COMPRESSION;
+  }
+}
+
+ComfyTexturesPngWriter::ComfyTexturesPngWriter(int InWidth, int InHeight, int InChannels, int InBitDepth, EComfyTexturesPngCompression InCompression) :
+  Width(InWidth), Height(InHeight), Channels(InChannels), BitDepth(InBitDepth), BytesPerPixel(InChannels * InBitDepth / 8), Level(GetZlibLevel(InCompression))
+{
+}
+
+bool ComfyTexturesPngWriter::Encode(TFunctionRef<void(int Y, int NumRows, uint8* OutRows)> GetRows, TArray64<uint8>& OutBytes)
+{
+  if (Width <= 0 || Height <= 0)
+  {
+    UE_LOG(LogComfyTextures, Error, TEXT("Invalid PNG size %dx%d"), Width, Height);
+    return false;
+  }
+
+  if ((Channels != 1 && Channels != 3 && Channels != 4) || (BitDepth != 8 && BitDepth != 16))
+  {
+    UE_LOG(LogComfyTextures, Error, TEXT("Unsupported PNG format with %d channels and %d bits"), Channels, BitDepth);
+    return false;
+  }
+
+  int RowsPerBand = FMath::Max(1, PngBandSize / (Width * BytesPerPixel + 1));
+  int NumBands = FMath::DivideAndRoundUp(Height, RowsPerBand);
+
+  TArray<FBand> Bands;
+  Bands.SetNum(NumBands);
+
+  ParallelFor(NumBands, [&](int Index)
+    {
+      int FirstRow = Index * RowsPerBand;
+      int NumRows = FMath::Min(RowsPerBand, Height - FirstRow);
+      CompressBand(FirstRow, NumRows, Index == NumBands - 1, GetRows, Bands[Index]);
+    });
+
+  // join the raw deflate bands into one zlib stream, the checksum is combined from the band checksums
+  TArray64<uint8> Idat;
+  Idat.Add(0x78);
+  Idat.Add(Level == Z_DEFAULT_COMPRESSION ? 0x9C : 0x01);
+
+  uLong Adler = adler32(0, nullptr, 0);
+
+  for (const FBand& Band : Bands)
+  {
+    if (!Band.bSuccess)
+    {
+      return false;
+    }
+
+    Idat.Append(Band.Compressed.GetData(), Band.Compressed.Num());
+    Adler = adler32_combine(Adler, Band.Adler, Band.Size);
+  }
+
+  uint8 AdlerBytes[4];
+  WriteBigEndian(AdlerBytes, Adler);
+  Idat.Append(AdlerBytes, 4);
+
+  Bytes.Reset();
+  Bytes.Reserve(Idat.Num() + 1024);
+
+  static const uint8 Signature[] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+  Bytes.Append(Signature, sizeof(Signature));
+
+  // grayscale, RGB or RGBA, default compression and filter methods, no interlacing
+  uint8 Header[13];
+  WriteBigEndian(Header + 0, Width);
+  WriteBigEndian(Header + 4, Height);
+  Header[8] = BitDepth;
+  Header[9] = Channels == 1 ? 0 : (Channels == 3 ? 2 : 6);
+  Header[10] = 0;
+  Header[11] = 0;
+  Header[12] = 0;
+  WriteChunk("IHDR", Header, sizeof(Header));
+
+  for (int64 Offset = 0; Offset < Idat.Num(); Offset += PngIdatChunkSize)
+  {
+    WriteChunk("IDAT", Idat.GetData() + Offset, FMath::Min<int64>(PngIdatChunkSize, Idat.Num() - Offset));
+  }
+
+  WriteChunk("IEND", nullptr, 0);
+
+  OutBytes = MoveTemp(Bytes);
+  return true;
+}
+
+void ComfyTexturesPngWriter::CompressBand(int FirstRow, int NumRows, bool bLastBand, TFunctionRef<void(int, int, uint8*)> GetRows, FBand& OutBand) const
+{
+  int RowSize = Width * BytesPerPixel;
+
+  TArray<uint8> Rows;
+  Rows.SetNumUninitialized(NumRows * RowSize);
+  GetRows(FirstRow, NumRows, Rows.GetData());
+
+  // sub filter, every byte stores the difference to the same byte of the previous pixel
+  TArray<uint8> Filtered;
+  Filtered.SetNumUninitialized(NumRows * (RowSize + 1));
+
+  for (int Y = 0; Y < NumRows; Y++)
+  {
+    const uint8* Row = Rows.GetData() + Y * RowSize;
+    uint8* OutRow = Filtered.GetData() + Y * (RowSize + 1);
+
+    OutRow[0] = 1;
+    OutRow++;
+
+    for (int Index = 0; Index < BytesPerPixel; Index++)
+    {
+      OutRow[Index] = Row[Index];
+    }
+
+    for (int Index = BytesPerPixel; Index < RowSize; Index++)
+    {
+      OutRow[Index] = (uint8)(Row[Index] - Row[Index - BytesPerPixel]);
+    }
+  }
+
+  OutBand.Size = Filtered.Num();
+  OutBand.Adler = adler32(adler32(0, nullptr, 0), Filtered.GetData(), Filtered.Num());
+
+  // raw deflate without header, bands before the last one end on a byte aligned sync flush
+  z_stream Stream = {};
+  if (deflateInit2(&Stream, Level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+  {
+    UE_LOG(LogComfyTextures, Error, TEXT("Failed to initialize PNG deflate stream"));
+    return;
+  }
+
+  OutBand.Compressed.SetNumUninitialized(deflateBound(&Stream, Filtered.Num()) + 64);
+
+  Stream.next_in = Filtered.GetData();
+  Stream.avail_in = Filtered.Num();
+
+  int Flush = bLastBand ? Z_FINISH : Z_SYNC_FLUSH;
+  int Written = 0;
+
+  while (true)
+  {
+    Stream.next_out = OutBand.Compressed.GetData() + Written;
+    Stream.avail_out = OutBand.Compressed.Num() - Written;
+
+    int Result = deflate(&Stream, Flush);
+    Written = OutBand.Compressed.Num() - Stream.avail_out;
+
+    if (Result == Z_STREAM_ERROR)
+    {
+      UE_LOG(LogComfyTextures, Error, TEXT("Failed to deflate PNG rows %d to %d"), FirstRow, FirstRow + NumRows);
+      deflateEnd(&Stream);
+      return;
+    }
+
+    if (Stream.avail_out != 0)
+    {
+      break;
+    }
+
+    OutBand.Compressed.SetNumUninitialized(OutBand.Compressed.Num() * 2);
+  }
+
+  deflateEnd(&Stream);
+
+  OutBand.Compressed.SetNum(Written);
+  OutBand.bSuccess = true;
+}
+
+void ComfyTexturesPngWriter::WriteChunk(const char* Type, const uint8* Data, int64 Size)
+{
+  uint8 Length[4];
+  WriteBigEndian(Length, Size);
+  Bytes.Append(Length, 4);
+
+  Bytes.Append((const uint8*)Type, 4);
+  uLong Crc = crc32(0, (const Bytef*)Type, 4);
+
+  if (Size > 0)
+  {
+    Bytes.Append(Data, Size);
+    Crc = crc32(Crc, Data, (uInt)Size);
+  }
+
+  uint8 CrcBytes[4];
+  WriteBigEndian(CrcBytes, Crc);
+  Bytes.Append(CrcBytes, 4);
+}
@@ -0,0 +1,50 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+enum class EComfyTexturesPngCompression : uint8;
+
+/**
+ * PNG encoder that produces and deflates bands of scanlines in parallel and joins them into one zlib stream
+ */
+class ComfyTexturesPngWriter
+{
+public:
+	// Channels is 1 for grayscale, 3 for RGB or 4 for RGBA, BitDepth is 8 or 16
+	ComfyTexturesPngWriter(int InWidth, int InHeight, int InChannels, int InBitDepth, EComfyTexturesPngCompression InCompression);
+
+	// GetRows fills NumRows scanlines starting at row Y with big endian samples, it is called concurrently for different bands
+	bool Encode(TFunctionRef<void(int Y, int NumRows, uint8* OutRows)> GetRows, TArray64<uint8>& OutBytes);
+
+private:
+	struct FBand
+	{
+		TArray<uint8> Compressed;
+
+		uint32 Adler = 1;
+
+		int64 Size = 0;
+
+		bool bSuccess = false;
+	};
+
+	void CompressBand(int FirstRow, int NumRows, bool bLastBand, TFunctionRef<void(int, int, uint8*)> GetRows, FBand& OutBand) const;
+
+	void WriteChunk(const char* Type, const uint8* Data, int64 Size);
+
+	const int Width;
+
+	const int Height;
+
+	const int Channels;
+
+	const int BitDepth;
+
+	const int BytesPerPixel;
+
+	const int Level;
+
+	TArray64<uint8> Bytes;
+};
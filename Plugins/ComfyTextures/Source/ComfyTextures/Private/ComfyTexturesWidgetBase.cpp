@@ -17,6 +17,11 @@
 #include "UObject/SavePackage.h"
 #include "ScopedTransaction.h"
 #include "Engine/Selection.h"
+#include "Async/ParallelFor.h"
+#include "Misc/ScopeLock.h"
+#include "ComfyTexturesPngWriter.h"
+#include "ComfyTexturesImageCodecs.h"
+#include "ComfyTexturesDepthPyramid.h"
 
 #define LOCTEXT_NAMESPACE "ComfyTextures"
 
@@ -91,7 +96,8 @@ int UComfyTexturesWidgetBase::GetNumPendingRequests() const
     }
   }
 
-  return NumPendingRequests;
+  // views that are still uploading will be queued shortly
+  return NumPendingRequests + NumPendingUploads;
 }
 
 bool UComfyTexturesWidgetBase::HasPendingRequests() const
@@ -145,96 +151,19 @@ bool UComfyTexturesWidgetBase::ProcessMultipleActors(const TArray<AActor*>& Acto
   ActorSet = Actors;
 
   TArray<FMinimalViewInfo> ViewInfos;
-  if (!CreateCameraTransforms(Actors[0], RenderOpts, ViewInfos))
+  if (!CreateCameraTransforms(Actors, RenderOpts, ViewInfos))
   {
     UE_LOG(LogComfyTextures, Error, TEXT("Failed to create camera transforms"));
     TransitionToIdleState();
     return false;
   }
 
-  UTexture2D* MagentaPixel = nullptr;
-  TMap<AActor*, TPair<UMaterialInstanceDynamic*, UTexture*>> ActorToTextureMap;
-
-  if (RenderOpts.Mode == EComfyTexturesMode::Edit && RenderOpts.Params.EditMaskMode == EComfyTexturesEditMaskMode::FromObject)
-  {
-    MagentaPixel = UTexture2D::CreateTransient(1, 1, PF_B8G8R8A8);
-
-    FTexturePlatformData* PlatformData = new FTexturePlatformData();
-    PlatformData->SizeX = 1;
-    PlatformData->SizeY = 1;
-    PlatformData->PixelFormat = PF_B8G8R8A8;
-
-    FTexture2DMipMap* Mip = new FTexture2DMipMap();
-    Mip->SizeX = 1;
-    Mip->SizeY = 1;
-    Mip->BulkData.Lock(LOCK_READ_WRITE);
-    Mip->BulkData.Realloc(4);
-    Mip->BulkData.Unlock();
-
-    FColor Magenta = FColor(255, 0, 255, 255);
-
-    void* TextureData = Mip->BulkData.Lock(LOCK_READ_WRITE);
-    FMemory::Memcpy(TextureData, &Magenta, 4);
-    Mip->BulkData.Unlock();
-
-    PlatformData->Mips.Add(Mip);
-
-    MagentaPixel->SetPlatformData(PlatformData);
-    MagentaPixel->UpdateResource();
-
-    for (AActor* Actor : Actors)
-    {
-      // replace the material of the static mesh with the magenta pixel texture
-
-      UStaticMeshComponent* StaticMeshComponent = Actor->FindComponentByClass<UStaticMeshComponent>();
-
-      // if the actor doesn't have a static mesh component, skip it
-      if (StaticMeshComponent == nullptr)
-      {
-        continue;
-      }
-
-      // get the material of the static mesh
-      UMaterialInterface* Material = StaticMeshComponent->GetMaterial(0);
-
-      // if the material is null, skip it
-
-      if (Material == nullptr)
-      {
-        UE_LOG(LogComfyTextures, Warning, TEXT("Material is null for actor %s."), *Actor->GetName());
-        continue;
-      }
-
-      // cast the material to a material instance dynamic
-      UMaterialInstanceDynamic* MaterialInstance = Cast<UMaterialInstanceDynamic>(Material);
-
-      // if the material is not a material instance dynamic, skip it
-      if (MaterialInstance == nullptr)
-      {
-        UE_LOG(LogComfyTextures, Warning, TEXT("Material is not a material instance dynamic for actor %s."), *Actor->GetName());
-        continue;
-      }
-
-      UTexture* OldTexture = nullptr;
-      if (!MaterialInstance->GetTextureParameterValue(TEXT("BaseColor"), OldTexture))
-      {
-        UE_LOG(LogComfyTextures, Warning, TEXT("Failed to get parameter value \"BaseColor\" for actor %s."), *Actor->GetName());
-        continue;
-      }
-
-      ActorToTextureMap.Add(Actor, TPair<UMaterialInstanceDynamic*, UTexture*>(MaterialInstance, OldTexture));
-
-      // set the texture parameter to the magenta pixel texture
-      MaterialInstance->SetTextureParameterValue(TEXT("BaseColor"), MagentaPixel);
-    }
-  }
-
   TSharedPtr<TArray<FComfyTexturesCaptureOutput>> CaptureResults = MakeShared<TArray<FComfyTexturesCaptureOutput>>();
 
   double CaptureSceneTexturesTime = 0.0;
   {
     SCOPE_SECONDS_COUNTER(CaptureSceneTexturesTime);
-    if (!CaptureSceneTextures(Actors[0]->GetWorld(), Actors, ViewInfos, RenderOpts.Mode, CaptureResults))
+    if (!CaptureSceneTextures(Actors[0]->GetWorld(), Actors, ViewInfos, RenderOpts.Mode, RenderOpts.Params.EditMaskMode, CaptureResults))
     {
       UE_LOG(LogComfyTextures, Error, TEXT("Failed to capture input textures"));
       TransitionToIdleState();
@@ -244,57 +173,61 @@ bool UComfyTexturesWidgetBase::ProcessMultipleActors(const TArray<AActor*>& Acto
 
   UE_LOG(LogComfyTextures, Display, TEXT("Capture scene textures took %f seconds"), CaptureSceneTexturesTime);
 
-  // bring back the original textures by iterating the actor to texture map
+  UComfyTexturesSettings* Settings = GetMutableDefault<UComfyTexturesSettings>();
 
-  for (TPair<AActor*, TPair<UMaterialInstanceDynamic*, UTexture*>>& Pair : ActorToTextureMap)
-  {
-    AActor* Actor = Pair.Key;
-    TPair<UMaterialInstanceDynamic*, UTexture*>& Value = Pair.Value;
+  NumPendingUploads = CaptureResults->Num();
 
-    UMaterialInstanceDynamic* MaterialInstance = Value.Key;
-    UTexture* OldTexture = Value.Value;
+  int UploadSize = FMath::RoundUpToPowerOfTwo(Settings->UploadSize);
+  EComfyTexturesUploadFormat DepthFormat = Settings->bUpload16BitDepth ? EComfyTexturesUploadFormat::Gray16 : EComfyTexturesUploadFormat::Gray8;
+  bool bPackUploadImages = Settings->bPackUploadImages;
+  bool bResizeOutputToTexture = Settings->bResizeOutputToTexture;
 
-    MaterialInstance->SetTextureParameterValue(TEXT("BaseColor"), OldTexture);
-  }
-
-  if (MagentaPixel != nullptr)
+  if (bPackUploadImages && Settings->bUpload16BitDepth)
   {
-    MagentaPixel->ConditionalBeginDestroy();
+    UE_LOG(LogComfyTextures, Warning, TEXT("Packed upload images store depth with 8 bits, Upload 16 Bit Depth is ignored"));
   }
 
-  UComfyTexturesSettings* Settings = GetMutableDefault<UComfyTexturesSettings>();
-
-  ProcessSceneTextures(CaptureResults, RenderOpts.Mode, Settings->UploadSize, [this, CaptureResults, ViewInfos, RenderOpts]()
+  ProcessSceneTextures(CaptureResults, RenderOpts.Mode, bPackUploadImages, [this, Actors, CaptureResults, ViewInfos, RenderOpts, UploadSize, DepthFormat, bPackUploadImages, bResizeOutputToTexture]()
     {
       for (int Index = 0; Index < CaptureResults->Num(); Index++)
       {
-        const FComfyTexturesCaptureOutput& Output = (*CaptureResults)[Index];
+        FComfyTexturesCaptureOutput& Output = (*CaptureResults)[Index];
         const FMinimalViewInfo& ViewInfo = ViewInfos[Index];
-        const FComfyTexturesImageData& RawDepth = Output.RawDepth;
-
-        TArray<FComfyTexturesImageData> Images;
-        TArray<FString> FileNames;
+        TSharedPtr<const ComfyTexturesDepthPyramid> DepthPyramid = Output.DepthPyramid;
+        const FMatrix& ViewMatrix = Output.ViewMatrix;
+        const FMatrix& ProjectionMatrix = Output.ProjectionMatrix;
+        const TArray<uint16>& ActorIds = Output.ActorIds;
 
-        Images.Add(Output.Depth);
-        FileNames.Add("depth_" + FString::FromInt(Index) + ".png");
+        // the workflows produce at least the upload size, anything smaller is always a downscale
+        int OutputSize = bResizeOutputToTexture ? CalculateRequiredOutputSize(Actors, ViewMatrix * ProjectionMatrix, UploadSize) : 0;
 
-        Images.Add(Output.Normals);
-        FileNames.Add("normals_" + FString::FromInt(Index) + ".png");
+        // the images are resized while they are encoded, nothing else reads them after this point
+        TArray<FComfyTexturesUploadImage> Images;
 
-        Images.Add(Output.Color);
-        FileNames.Add("color_" + FString::FromInt(Index) + ".png");
-
-        Images.Add(Output.EdgeMask);
-        FileNames.Add("edge_mask_" + FString::FromInt(Index) + ".png");
-
-        if (RenderOpts.Mode == EComfyTexturesMode::Edit)
+        if (bPackUploadImages)
         {
-          Images.Add(Output.EditMask);
-          FileNames.Add("mask_" + FString::FromInt(Index) + ".png");
+          // normals and color keep the profiles of the unpacked upload so both halves get the same bytes
+          Images.Add({ MoveTemp(Output.PackedData), "data_" + FString::FromInt(Index) + ".png", EComfyTexturesUploadFormat::Rgb8, EComfyTexturesEncodeProfile::Data });
+          Images.Add({ MoveTemp(Output.PackedViews), "views_" + FString::FromInt(Index) + ".png", EComfyTexturesUploadFormat::Rgb8, EComfyTexturesEncodeProfile::Data,
+            { EComfyTexturesEncodeProfile::Data, EComfyTexturesEncodeProfile::Color } });
         }
+        else
+        {
+          Images.Add({ MoveTemp(Output.Depth), "depth_" + FString::FromInt(Index) + ".png", DepthFormat, EComfyTexturesEncodeProfile::Data });
+          Images.Add({ MoveTemp(Output.Normals), "normals_" + FString::FromInt(Index) + ".png", EComfyTexturesUploadFormat::Rgba8, EComfyTexturesEncodeProfile::Data });
+          Images.Add({ MoveTemp(Output.Color), "color_" + FString::FromInt(Index) + ".png", EComfyTexturesUploadFormat::Rgba8, EComfyTexturesEncodeProfile::Color });
+          Images.Add({ MoveTemp(Output.EdgeMask), "edge_mask_" + FString::FromInt(Index) + ".png", EComfyTexturesUploadFormat::Gray8, EComfyTexturesEncodeProfile::Data });
 
-        bool bSuccess = UploadImages(Images, FileNames, [this, RenderOpts, ViewInfo, RawDepth](const TArray<FString>& FileNames, bool bSuccess)
+          if (RenderOpts.Mode == EComfyTexturesMode::Edit)
           {
+            Images.Add({ MoveTemp(Output.EditMask), "mask_" + FString::FromInt(Index) + ".png", EComfyTexturesUploadFormat::Gray8, EComfyTexturesEncodeProfile::Mask });
+          }
+        }
+
+        bool bSuccess = UploadImages(MoveTemp(Images), UploadSize, [this, RenderOpts, ViewInfo, ViewMatrix, ProjectionMatrix, DepthPyramid, ActorIds, bPackUploadImages, UploadSize, OutputSize](const TArray<FString>& FileNames, bool bSuccess)
+          {
+            NumPendingUploads = FMath::Max(NumPendingUploads - 1, 0);
+
             if (!bSuccess)
             {
               UE_LOG(LogComfyTextures, Error, TEXT("Upload failed"));
@@ -310,14 +243,25 @@ bool UComfyTexturesWidgetBase::ProcessMultipleActors(const TArray<AActor*>& Acto
             }
 
             FComfyTexturesRenderOptions NewRenderOpts = RenderOpts;
-            NewRenderOpts.DepthImageFilename = FileNames[0];
-            NewRenderOpts.NormalsImageFilename = FileNames[1];
-            NewRenderOpts.ColorImageFilename = FileNames[2];
-            NewRenderOpts.EdgeMaskImageFilename = FileNames[3];
+            NewRenderOpts.OutputSize = OutputSize;
 
-            if (RenderOpts.Mode == EComfyTexturesMode::Edit)
+            if (bPackUploadImages)
+            {
+              NewRenderOpts.PackedDataImageFilename = FileNames[0];
+              NewRenderOpts.PackedViewsImageFilename = FileNames[1];
+              NewRenderOpts.PackedViewSize = UploadSize;
+            }
+            else
             {
-              NewRenderOpts.MaskImageFilename = FileNames[4];
+              NewRenderOpts.DepthImageFilename = FileNames[0];
+              NewRenderOpts.NormalsImageFilename = FileNames[1];
+              NewRenderOpts.ColorImageFilename = FileNames[2];
+              NewRenderOpts.EdgeMaskImageFilename = FileNames[3];
+
+              if (RenderOpts.Mode == EComfyTexturesMode::Edit)
+              {
+                NewRenderOpts.MaskImageFilename = FileNames[4];
+              }
             }
 
             if (State == EComfyTexturesState::Idle)
@@ -334,11 +278,6 @@ bool UComfyTexturesWidgetBase::ProcessMultipleActors(const TArray<AActor*>& Acto
               return;
             }
 
-            TOptional<FMatrix> CustomProjectionMatrix;
-            FMatrix ViewMatrix, ProjectionMatrix, ViewProjectionMatrix;
-            UGameplayStatics::CalculateViewProjectionMatricesFromMinimalView(ViewInfo, CustomProjectionMatrix,
-              ViewMatrix, ProjectionMatrix, ViewProjectionMatrix);
-
             if (!RenderQueue.Contains(RequestIndex))
             {
               UE_LOG(LogComfyTextures, Error, TEXT("Render queue does not contain request index"));
@@ -350,7 +289,8 @@ bool UComfyTexturesWidgetBase::ProcessMultipleActors(const TArray<AActor*>& Acto
             Data->ViewInfo = ViewInfo;
             Data->ViewMatrix = ViewMatrix;
             Data->ProjectionMatrix = ProjectionMatrix;
-            Data->RawDepth = RawDepth;
+            Data->DepthPyramid = DepthPyramid;
+            Data->ActorIds = ActorIds;
             Data->bPreserveExisting = RenderOpts.bPreserveExisting;
             Data->PreserveThreshold = RenderOpts.PreserveThreshold;
           });
@@ -366,7 +306,7 @@ bool UComfyTexturesWidgetBase::ProcessMultipleActors(const TArray<AActor*>& Acto
   return true;
 }
 
-static FLinearColor SampleBilinear(const TArray<FColor>& Pixels, int Width, int Height, FVector2D Uv)
+static FLinearColor SampleBilinear(const FColor* Pixels, int Width, int Height, FVector2D Uv)
 {
   // clamp the UV coordinates
   Uv.X = FMath::Clamp(Uv.X, 0.0f, 1.0f);
@@ -405,86 +345,229 @@ static FLinearColor SampleBilinear(const TArray<FColor>& Pixels, int Width, int
   return Pixel;
 }
 
-static void ExpandTextureIslands(TArray<FColor>& Pixels, int Width, int Height, int Iterations)
+// fills a gutter of GutterWidth texels around the baked texture islands with the average of the neighboring texels,
+// every ring only visits the frontier next to the previous ring so the work is proportional to the gutter area
+static void ExpandTextureIslands(TArray<FColor>& Pixels, int Width, int Height, int GutterWidth)
 {
-  for (int Iteration = 0; Iteration < Iterations; Iteration++)
+  if (GutterWidth <= 0)
   {
-    TArray<FColor> PixelsCopy = Pixels;
+    return;
+  }
+
+  // ring each texel was filled in, zero for baked texels
+  const uint8 Unfilled = MAX_uint8;
+  GutterWidth = FMath::Min(GutterWidth, (int)Unfilled - 1);
+
+  TArray<uint8> Rings;
+  Rings.SetNumUninitialized(Pixels.Num());
+
+  const int RowsPerTask = 64;
+  int NumTasks = FMath::DivideAndRoundUp(Height, RowsPerTask);
 
-    for (int Y = 0; Y < Height; Y++)
+  // texels of the current ring, one list per task so they can be gathered without locking
+  TArray<TArray<int>> Frontiers;
+  Frontiers.SetNum(NumTasks);
+
+  ParallelFor(NumTasks, [&](int Task)
     {
-      for (int X = 0; X < Width; X++)
+      int EndY = FMath::Min((Task + 1) * RowsPerTask, Height);
+      for (int Y = Task * RowsPerTask; Y < EndY; Y++)
       {
-        int Index = Y * Width + X;
-        FColor Pixel = PixelsCopy[Index];
-        if (Pixel.A > 0)
+        for (int X = 0; X < Width; X++)
         {
-          continue;
+          int Index = Y * Width + X;
+          Rings[Index] = Pixels[Index].A > 0 ? 0 : Unfilled;
         }
+      }
+    });
 
-        int NeighborCount = 0;
-        FLinearColor NeighborColorSum(0.0f, 0.0f, 0.0f, 0.0f);
+  auto ForEachNeighbor = [Width, Height](int Index, auto&& Function)
+    {
+      int X = Index % Width;
+      int Y = Index / Width;
 
-        // check the pixel's neighbors
+      if (X > 0) Function(Index - 1);
+      if (X < Width - 1) Function(Index + 1);
+      if (Y > 0) Function(Index - Width);
+      if (Y < Height - 1) Function(Index + Width);
+    };
 
-        if (X > 0)
+  // the first ring are the empty texels next to a baked texel
+  ParallelFor(NumTasks, [&](int Task)
+    {
+      int EndY = FMath::Min((Task + 1) * RowsPerTask, Height);
+      for (int Y = Task * RowsPerTask; Y < EndY; Y++)
+      {
+        for (int X = 0; X < Width; X++)
         {
-          int NeighborIndex = Y * Width + (X - 1);
-          FColor& NeighborPixel = PixelsCopy[NeighborIndex];
-          if (NeighborPixel.A > 0)
+          int Index = Y * Width + X;
+          if (Rings[Index] != Unfilled)
           {
-            NeighborCount++;
-            NeighborColorSum += NeighborPixel.ReinterpretAsLinear();
+            continue;
           }
-        }
 
-        if (X < Width - 1)
-        {
-          int NeighborIndex = Y * Width + (X + 1);
-          FColor& NeighborPixel = PixelsCopy[NeighborIndex];
-          if (NeighborPixel.A > 0)
-          {
-            NeighborCount++;
-            NeighborColorSum += NeighborPixel.ReinterpretAsLinear();
-          }
-        }
+          bool bHasBakedNeighbor = false;
+          ForEachNeighbor(Index, [&](int NeighborIndex) { bHasBakedNeighbor |= Rings[NeighborIndex] == 0; });
 
-        if (Y > 0)
-        {
-          int NeighborIndex = (Y - 1) * Width + X;
-          FColor& NeighborPixel = PixelsCopy[NeighborIndex];
-          if (NeighborPixel.A > 0)
+          if (bHasBakedNeighbor)
           {
-            NeighborCount++;
-            NeighborColorSum += NeighborPixel.ReinterpretAsLinear();
+            Frontiers[Task].Add(Index);
           }
         }
+      }
+    });
 
-        if (Y < Height - 1)
+  for (TArray<int>& Frontier : Frontiers)
+  {
+    for (int Index : Frontier)
+    {
+      Rings[Index] = 1;
+    }
+  }
+
+  for (int Ring = 1; Ring <= GutterWidth; Ring++)
+  {
+    // average the texels filled before this ring, the alpha stays zero so the gutter is not treated as baked
+    ParallelFor(Frontiers.Num(), [&](int Task)
+      {
+        for (int Index : Frontiers[Task])
         {
-          int NeighborIndex = (Y + 1) * Width + X;
-          FColor& NeighborPixel = PixelsCopy[NeighborIndex];
-          if (NeighborPixel.A > 0)
+          int Count = 0;
+          int SumR = 0;
+          int SumG = 0;
+          int SumB = 0;
+
+          ForEachNeighbor(Index, [&](int NeighborIndex)
+            {
+              if (Rings[NeighborIndex] < Ring)
+              {
+                const FColor& Neighbor = Pixels[NeighborIndex];
+                SumR += Neighbor.R;
+                SumG += Neighbor.G;
+                SumB += Neighbor.B;
+                Count++;
+              }
+            });
+
+          if (Count > 0)
           {
-            NeighborCount++;
-            NeighborColorSum += NeighborPixel.ReinterpretAsLinear();
+            Pixels[Index] = FColor(SumR / Count, SumG / Count, SumB / Count, 0);
           }
         }
+      });
 
-        if (NeighborCount > 0)
+    if (Ring == GutterWidth)
+    {
+      break;
+    }
+
+    // claim the unfilled neighbors of this ring for the next one, the exchange makes sure every texel is claimed once
+    TArray<TArray<int>> NextFrontiers;
+    NextFrontiers.SetNum(Frontiers.Num());
+
+    ParallelFor(Frontiers.Num(), [&](int Task)
+      {
+        for (int Index : Frontiers[Task])
         {
-          Pixel.R = (NeighborColorSum.R / NeighborCount) * 255.0f;
-          Pixel.G = (NeighborColorSum.G / NeighborCount) * 255.0f;
-          Pixel.B = (NeighborColorSum.B / NeighborCount) * 255.0f;
-          Pixel.A = 0;
-          Pixels[Index] = Pixel;
+          ForEachNeighbor(Index, [&](int NeighborIndex)
+            {
+              if (Rings[NeighborIndex] == Unfilled &&
+                FPlatformAtomics::InterlockedCompareExchange((volatile int8*)&Rings[NeighborIndex], (int8)(Ring + 1), (int8)Unfilled) == (int8)Unfilled)
+              {
+                NextFrontiers[Task].Add(NeighborIndex);
+              }
+            });
         }
+      });
+
+    Frontiers = MoveTemp(NextFrontiers);
+  }
+}
+
+// walks the texels of the bounding box with incremental edge functions, Scale is the size of one texel in vertex units,
+// integer edge functions follow the top left fill rule so texels on a shared edge belong to exactly one triangle
+template<typename ValueType, typename FunctorType>
+static void RasterizeTriangleEdges(const ValueType* VertexX, const ValueType* VertexY, ValueType Scale, int MinX, int MinY, int MaxX, int MaxY, FunctorType& Callback)
+{
+  ValueType Area = (VertexX[1] - VertexX[0]) * (VertexY[2] - VertexY[0]) - (VertexY[1] - VertexY[0]) * (VertexX[2] - VertexX[0]);
+  if (Area == 0)
+  {
+    return;
+  }
+
+  // wind the triangle so the edge functions are positive inside
+  int Order[3] = { 0, 1, 2 };
+  if (Area < 0)
+  {
+    Swap(Order[1], Order[2]);
+    Area = -Area;
+  }
+
+  // edge K is opposite of vertex Order[K] and its function is the unnormalized barycentric weight of that vertex
+  ValueType Row[3];
+  ValueType StepX[3];
+  ValueType StepY[3];
+  ValueType Bias[3];
+
+  for (int K = 0; K < 3; K++)
+  {
+    int A = Order[(K + 1) % 3];
+    int B = Order[(K + 2) % 3];
+
+    ValueType Dx = VertexX[B] - VertexX[A];
+    ValueType Dy = VertexY[B] - VertexY[A];
+
+    StepX[K] = -Dy * Scale;
+    StepY[K] = Dx * Scale;
+    Row[K] = Dx * (MinY * Scale - VertexY[A]) - Dy * (MinX * Scale - VertexX[A]);
+
+    bool bTopLeft = Dy < 0 || (Dy == 0 && Dx > 0);
+    Bias[K] = TIsIntegral<ValueType>::Value && !bTopLeft ? -1 : 0;
+  }
+
+  const double InvArea = 1.0 / (double)Area;
+
+  for (int Y = MinY; Y <= MaxY; Y++)
+  {
+    ValueType W0 = Row[0];
+    ValueType W1 = Row[1];
+    ValueType W2 = Row[2];
+    bool bInside = false;
+
+    for (int X = MinX; X <= MaxX; X++)
+    {
+      if (W0 + Bias[0] >= 0 && W1 + Bias[1] >= 0 && W2 + Bias[2] >= 0)
+      {
+        bInside = true;
+
+        FVector Barycentric;
+        Barycentric[Order[0]] = W0 * InvArea;
+        Barycentric[Order[1]] = W1 * InvArea;
+        Barycentric[Order[2]] = W2 * InvArea;
+
+        Callback(X, Y, Barycentric);
+      }
+      else if (bInside)
+      {
+        // the triangle is convex, the rest of the row is outside
+        break;
       }
+
+      W0 += StepX[0];
+      W1 += StepX[1];
+      W2 += StepX[2];
     }
+
+    Row[0] += StepY[0];
+    Row[1] += StepY[1];
+    Row[2] += StepY[2];
   }
 }
 
-static void RasterizeTriangle(FVector2D V0, FVector2D V1, FVector2D V2, int Width, int Height, TFunction<void(int, int, const FVector&)> Callback)
+// calls Callback with the barycentric coordinates of every texel center inside the triangle in the rows from FirstRow
+// to EndRow, the vertices are in 0..1 texture space, the texels are the same whichever rows are rasterized
+template<typename FunctorType>
+static void RasterizeTriangleRows(FVector2D V0, FVector2D V1, FVector2D V2, int Width, int Height, int FirstRow, int EndRow, FunctorType&& Callback)
 {
   FVector2D Size(Width - 1, Height - 1);
   V0 *= Size;
@@ -493,23 +576,461 @@ static void RasterizeTriangle(FVector2D V0, FVector2D V1, FVector2D V2, int Widt
 
   // Bounding box
   int MinX = FMath::FloorToInt(FMath::Max(FMath::Min3(V0.X, V1.X, V2.X), 0));
-  int MinY = FMath::FloorToInt(FMath::Max(FMath::Min3(V0.Y, V1.Y, V2.Y), 0));
+  int MinY = FMath::FloorToInt(FMath::Max(FMath::Min3(V0.Y, V1.Y, V2.Y), FirstRow));
   int MaxX = FMath::CeilToInt(FMath::Min(FMath::Max3(V0.X, V1.X, V2.X), Width - 1));
-  int MaxY = FMath::CeilToInt(FMath::Min(FMath::Max3(V0.Y, V1.Y, V2.Y), Height - 1));
+  int MaxY = FMath::CeilToInt(FMath::Min(FMath::Max3(V0.Y, V1.Y, V2.Y), EndRow - 1));
 
-  for (int Y = MinY; Y <= MaxY; Y++)
+  if (MinX > MaxX || MinY > MaxY)
   {
-    for (int X = MinX; X <= MaxX; X++)
+    return;
+  }
+
+  // vertices are snapped to 1/256 of a texel, below 2^29 sub texels the differences stay below 2^30 so every
+  // product is below 2^60 and the sums in the edge functions and the area fit in 64 bits, projected vertices
+  // close to the camera can exceed that and take the double path
+  const double SubTexels = 256.0;
+  const double MaxCoordinate = (double)(1 << 29) / SubTexels;
+
+  if (FMath::Max3(FMath::Abs(V0.X), FMath::Abs(V1.X), FMath::Abs(V2.X)) < MaxCoordinate &&
+    FMath::Max3(FMath::Abs(V0.Y), FMath::Abs(V1.Y), FMath::Abs(V2.Y)) < MaxCoordinate)
+  {
+    int64 VertexX[3] = { FMath::RoundToInt64(V0.X * SubTexels), FMath::RoundToInt64(V1.X * SubTexels), FMath::RoundToInt64(V2.X * SubTexels) };
+    int64 VertexY[3] = { FMath::RoundToInt64(V0.Y * SubTexels), FMath::RoundToInt64(V1.Y * SubTexels), FMath::RoundToInt64(V2.Y * SubTexels) };
+    RasterizeTriangleEdges<int64>(VertexX, VertexY, (int64)SubTexels, MinX, MinY, MaxX, MaxY, Callback);
+  }
+  else
+  {
+    double VertexX[3] = { V0.X, V1.X, V2.X };
+    double VertexY[3] = { V0.Y, V1.Y, V2.Y };
+    RasterizeTriangleEdges<double>(VertexX, VertexY, 1.0, MinX, MinY, MaxX, MaxY, Callback);
+  }
+}
+
+// calls Callback with the barycentric coordinates of every texel center inside the triangle, the vertices are in 0..1 texture space
+template<typename FunctorType>
+static void RasterizeTriangle(FVector2D V0, FVector2D V1, FVector2D V2, int Width, int Height, FunctorType&& Callback)
+{
+  RasterizeTriangleRows(V0, V1, V2, Width, Height, 0, Height, Callback);
+}
+
+static void CopyWorldSpaceMeshData(AActor* Actor, FComfyTexturesMeshData& OutMesh)
+{
+  UStaticMeshComponent* StaticMeshComponent = Actor != nullptr ? Actor->FindComponentByClass<UStaticMeshComponent>() : nullptr;
+  if (StaticMeshComponent == nullptr || StaticMeshComponent->GetStaticMesh() == nullptr)
+  {
+    return;
+  }
+
+  const FStaticMeshLODResources& MeshLod = StaticMeshComponent->GetStaticMesh()->GetLODForExport(0);
+  const FTransform& ActorTransform = Actor->GetActorTransform();
+
+  MeshLod.IndexBuffer.GetCopy(OutMesh.Indices);
+
+  int VertexCount = MeshLod.VertexBuffers.PositionVertexBuffer.GetNumVertices();
+  OutMesh.Vertices.SetNumUninitialized(VertexCount);
+
+  for (int32 VertexIndex = 0; VertexIndex < VertexCount; VertexIndex++)
+  {
+    FVector Vertex = (FVector)MeshLod.VertexBuffers.PositionVertexBuffer.VertexPosition(VertexIndex);
+    OutMesh.Vertices[VertexIndex] = ActorTransform.TransformPosition(Vertex);
+  }
+}
+
+// rasterize the actor meshes in screen space and store the index of the closest actor for every pixel,
+// the vertices are projected once and every band of rows rasterizes all triangles that reach into it
+static void CreateActorIdImage(const TArray<FComfyTexturesMeshData>& Meshes, const FMatrix& ViewMatrix, const FMatrix& ProjectionMatrix, int Width, int Height, TArray<uint16>& OutActorIds)
+{
+  OutActorIds.Init(MAX_uint16, Width * Height);
+
+  if (Meshes.Num() >= MAX_uint16)
+  {
+    UE_LOG(LogComfyTextures, Warning, TEXT("Too many actors for the actor id image."));
+    OutActorIds.Empty();
+    return;
+  }
+
+  TArray<float> Depths;
+  Depths.Init(FLT_MAX, Width * Height);
+
+  // perspective projections divide by view depth, orthographic ones have a constant W
+  bool bIsPerspective = ProjectionMatrix.M[3][3] < 0.5f;
+  FMatrix ViewProjectionMatrix = ViewMatrix * ProjectionMatrix;
+
+  TArray<TArray<FVector2D>> ScreenUvs;
+  TArray<TArray<float>> ViewDepths;
+  ScreenUvs.SetNum(Meshes.Num());
+  ViewDepths.SetNum(Meshes.Num());
+
+  ParallelFor(Meshes.Num(), [&](int ActorIndex)
+    {
+      const FComfyTexturesMeshData& Mesh = Meshes[ActorIndex];
+      TArray<FVector2D>& MeshScreenUvs = ScreenUvs[ActorIndex];
+      TArray<float>& MeshViewDepths = ViewDepths[ActorIndex];
+
+      MeshScreenUvs.SetNumUninitialized(Mesh.Vertices.Num());
+      MeshViewDepths.SetNumUninitialized(Mesh.Vertices.Num());
+
+      for (int VertexIndex = 0; VertexIndex < Mesh.Vertices.Num(); VertexIndex++)
+      {
+        const FVector& WorldPosition = Mesh.Vertices[VertexIndex];
+        FPlane Result = ViewProjectionMatrix.TransformFVector4(FVector4(WorldPosition, 1.f));
+
+        // vertices behind the camera are flagged with a negative depth
+        if (Result.W <= 0.0f)
+        {
+          MeshViewDepths[VertexIndex] = -1.0f;
+          continue;
+        }
+
+        MeshScreenUvs[VertexIndex] = FVector2D((Result.X / Result.W) * 0.5f + 0.5f, 0.5f - (Result.Y / Result.W) * 0.5f);
+        MeshViewDepths[VertexIndex] = FMath::Max((float)ViewMatrix.TransformPosition(WorldPosition).Z, KINDA_SMALL_NUMBER);
+      }
+    });
+
+  // the bands own disjoint rows and visit the triangles in the same order, so the result matches a single pass
+  const int RowsPerBand = 32;
+  const float RowScale = (float)FMath::Max(Height - 1, 1);
+
+  ParallelFor(FMath::DivideAndRoundUp(Height, RowsPerBand), [&](int Band)
+    {
+      int FirstRow = Band * RowsPerBand;
+      int EndRow = FMath::Min(FirstRow + RowsPerBand, Height);
+
+      for (int ActorIndex = 0; ActorIndex < Meshes.Num(); ActorIndex++)
+      {
+        const FComfyTexturesMeshData& Mesh = Meshes[ActorIndex];
+        const TArray<FVector2D>& MeshScreenUvs = ScreenUvs[ActorIndex];
+        const TArray<float>& MeshViewDepths = ViewDepths[ActorIndex];
+
+        for (int FaceIndex = 0; FaceIndex + 2 < Mesh.Indices.Num(); FaceIndex += 3)
+        {
+          uint32 Index0 = Mesh.Indices[FaceIndex];
+          uint32 Index1 = Mesh.Indices[FaceIndex + 1];
+          uint32 Index2 = Mesh.Indices[FaceIndex + 2];
+
+          float Depth0 = MeshViewDepths[Index0];
+          float Depth1 = MeshViewDepths[Index1];
+          float Depth2 = MeshViewDepths[Index2];
+
+          if (Depth0 < 0.0f || Depth1 < 0.0f || Depth2 < 0.0f)
+          {
+            continue;
+          }
+
+          const FVector2D& Uv0 = MeshScreenUvs[Index0];
+          const FVector2D& Uv1 = MeshScreenUvs[Index1];
+          const FVector2D& Uv2 = MeshScreenUvs[Index2];
+
+          // triangles outside of the band are skipped before any setup
+          if (FMath::Max3(Uv0.Y, Uv1.Y, Uv2.Y) * RowScale < FirstRow - 1 || FMath::Min3(Uv0.Y, Uv1.Y, Uv2.Y) * RowScale > EndRow)
+          {
+            continue;
+          }
+
+          RasterizeTriangleRows(Uv0, Uv1, Uv2, Width, Height, FirstRow, EndRow, [&](int X, int Y, const FVector& Barycentric)
+            {
+              // perspective depth is linear in screen space only as 1 / z
+              float Depth = bIsPerspective ?
+                1.0f / (Barycentric.X / Depth0 + Barycentric.Y / Depth1 + Barycentric.Z / Depth2) :
+                Barycentric.X * Depth0 + Barycentric.Y * Depth1 + Barycentric.Z * Depth2;
+
+              int PixelIndex = X + Y * Width;
+              if (Depth < Depths[PixelIndex])
+              {
+                Depths[PixelIndex] = Depth;
+                OutActorIds[PixelIndex] = (uint16)ActorIndex;
+              }
+            });
+        }
+      }
+    });
+}
+
+struct FBakeState
+{
+  TArray<uint32> Indices;
+  TArray<FVector> Vertices;
+  TArray<FVector2D> Uvs;
+  TSharedPtr<TArray<FColor>> Pixels;
+  TArray<FComfyTexturesRenderDataPtr> RenderData;
+  FTransform ActorTransform;
+  UTexture2D* Texture2D;
+  // the material can be replaced or destroyed while the bake runs
+  TWeakObjectPtr<UMaterialInstanceDynamic> MaterialInstance;
+  AActor* Actor;
+  int ActorIndex;
+  int TextureWidth;
+  int TextureHeight;
+  int GutterWidth;
+  bool bBakeFinished = false;
+};
+
+// projects every render result onto the texels of a Width x Height texture, Pixels holds the existing texels when they are preserved
+static void BakeRenderResults(const FBakeState& State, TArray<FColor>& Pixels, int Width, int Height, int GutterWidth)
+{
+  // best view facing ratio written to each texel so far
+  TArray<float> Weights;
+  Weights.SetNumZeroed(Pixels.Num());
+
+  for (const FComfyTexturesRenderDataPtr& RenderData : State.RenderData)
+  {
+    const FMinimalViewInfo& ViewInfo = RenderData->ViewInfo;
+    const FMatrix& ViewMatrix = RenderData->ViewMatrix;
+    const FMatrix& ProjectionMatrix = RenderData->ProjectionMatrix;
+
+    FMatrix ViewProjectionMatrix = ViewMatrix * ProjectionMatrix;
+
+    if (!RenderData->DepthPyramid.IsValid() || RenderData->DepthPyramid->GetWidth() <= 0)
     {
-      FVector Barycentric = FMath::GetBaryCentric2D(FVector2D(X, Y), V0, V1, V2);
-      if (Barycentric.X < 0 || Barycentric.Y < 0 || Barycentric.Z < 0)
+      continue;
+    }
+
+    const ComfyTexturesDepthPyramid& DepthPyramid = *RenderData->DepthPyramid;
+    const bool bPerspective = ViewInfo.ProjectionMode == ECameraProjectionMode::Perspective;
+    const bool bHasActorIds = RenderData->ActorIds.Num() == DepthPyramid.GetWidth() * DepthPyramid.GetHeight();
+
+    // depth the occlusion test compares against, view space depth for perspective and device depth for orthographic views
+    auto GetOccluderDepth = [bPerspective, &ProjectionMatrix](float ClosestDepth)
+      {
+        if (bPerspective)
+        {
+          return ClosestDepth;
+        }
+
+        FVector4 ClipSpacePoint = ProjectionMatrix.TransformFVector4(FVector4(0.0f, 0.0f, ClosestDepth, 1.0f));
+        return (float)(ClipSpacePoint.Z / ClipSpacePoint.W);
+      };
+
+    // Iterate over the faces
+    for (int32 FaceIndex = 0; FaceIndex < State.Indices.Num(); FaceIndex += 3)
+    {
+      // Each face is represented by 3 indices
+      uint32 Index0 = State.Indices[FaceIndex];
+      uint32 Index1 = State.Indices[FaceIndex + 1];
+      uint32 Index2 = State.Indices[FaceIndex + 2];
+
+      // get the vertices of the face
+      const FVector& Vertex0 = State.Vertices[Index0];
+      const FVector& Vertex1 = State.Vertices[Index1];
+      const FVector& Vertex2 = State.Vertices[Index2];
+
+      FVector FaceNormal = -FVector::CrossProduct(Vertex1 - Vertex0, Vertex2 - Vertex0).GetSafeNormal();
+      FVector FaceNormalWorld = State.ActorTransform.TransformVector(FaceNormal);
+
+      float FaceDot = 0.0f;
+      if (ViewInfo.ProjectionMode == ECameraProjectionMode::Perspective)
+      {
+        FVector Vertex0World = State.ActorTransform.TransformPosition(Vertex0);
+        FaceDot = FVector::DotProduct(FaceNormalWorld, (ViewInfo.Location - Vertex0World).GetSafeNormal());
+      }
+      else if (ViewInfo.ProjectionMode == ECameraProjectionMode::Orthographic)
+      {
+        // get forward vector of viewinfo
+        FVector Forward = ViewInfo.Rotation.Vector();
+        FaceDot = FVector::DotProduct(FaceNormalWorld, -Forward);
+      }
+
+      if (FaceDot <= 0.0f)
       {
         continue;
       }
 
-      Callback(X, Y, Barycentric);
+      // get the UVs of the face
+      const FVector2D& Uv0 = State.Uvs[Index0];
+      const FVector2D& Uv1 = State.Uvs[Index1];
+      const FVector2D& Uv2 = State.Uvs[Index2];
+
+      // the texels of a triangle lie inside the screen bounds and the depth range of its corners, so the whole triangle
+      // is tested against the depth pyramid first, it is skipped when fully occluded and the per texel test is skipped
+      // when it is fully visible
+      bool bTestTexelDepth = true;
+
+      FPlane Corners[3] =
+      {
+        ViewProjectionMatrix.TransformFVector4(FVector4(State.ActorTransform.TransformPosition(Vertex0), 1.0f)),
+        ViewProjectionMatrix.TransformFVector4(FVector4(State.ActorTransform.TransformPosition(Vertex1), 1.0f)),
+        ViewProjectionMatrix.TransformFVector4(FVector4(State.ActorTransform.TransformPosition(Vertex2), 1.0f))
+      };
+
+      if (Corners[0].W > 0.0f && Corners[1].W > 0.0f && Corners[2].W > 0.0f)
+      {
+        FVector2D ScreenMin(FLT_MAX, FLT_MAX);
+        FVector2D ScreenMax(-FLT_MAX, -FLT_MAX);
+        float TriangleMinDepth = FLT_MAX;
+        float TriangleMaxDepth = -FLT_MAX;
+
+        for (const FPlane& Corner : Corners)
+        {
+          FVector2D Uv((Corner.X / Corner.W) * 0.5f + 0.5f, 0.5f - (Corner.Y / Corner.W) * 0.5f);
+          ScreenMin = FVector2D::Min(ScreenMin, Uv);
+          ScreenMax = FVector2D::Max(ScreenMax, Uv);
+
+          // clip space W is the view space depth for perspective projections
+          float CornerDepth = bPerspective ? Corner.W : Corner.Z / Corner.W;
+          TriangleMinDepth = FMath::Min(TriangleMinDepth, CornerDepth);
+          TriangleMaxDepth = FMath::Max(TriangleMaxDepth, CornerDepth);
+        }
+
+        ScreenMin = FVector2D::Max(ScreenMin, FVector2D(0.0f, 0.0f));
+        ScreenMax = FVector2D::Min(ScreenMax, FVector2D(1.0f, 1.0f));
+
+        if (ScreenMin.X > ScreenMax.X || ScreenMin.Y > ScreenMax.Y)
+        {
+          continue;
+        }
+
+        float ClosestMin = 0.0f;
+        float ClosestMax = 0.0f;
+        DepthPyramid.GetDepthRange(
+          FMath::FloorToInt(ScreenMin.X * (DepthPyramid.GetWidth() - 1)), FMath::FloorToInt(ScreenMin.Y * (DepthPyramid.GetHeight() - 1)),
+          FMath::FloorToInt(ScreenMax.X * (DepthPyramid.GetWidth() - 1)), FMath::FloorToInt(ScreenMax.Y * (DepthPyramid.GetHeight() - 1)),
+          ClosestMin, ClosestMax);
+
+        float OccluderA = GetOccluderDepth(ClosestMin);
+        float OccluderB = GetOccluderDepth(ClosestMax);
+        float OccluderMin = FMath::Min(OccluderA, OccluderB);
+        float OccluderMax = FMath::Max(OccluderA, OccluderB);
+
+        if (bPerspective)
+        {
+          const float Eps = 5.0f;
+          if (TriangleMinDepth > OccluderMax + Eps)
+          {
+            continue;
+          }
+
+          bTestTexelDepth = TriangleMaxDepth > OccluderMin + Eps;
+        }
+        else
+        {
+          const float Eps = 0.01f;
+          if (TriangleMaxDepth < OccluderMin - Eps)
+          {
+            continue;
+          }
+
+          bTestTexelDepth = TriangleMinDepth < OccluderMax - Eps;
+        }
+      }
+
+      RasterizeTriangle(Uv0, Uv1, Uv2, Width, Height, [&](int X, int Y, const FVector& Barycentric)
+        {
+          int PixelIndex = X + Y * Width;
+          if (PixelIndex < 0 || PixelIndex >= Pixels.Num())
+          {
+            return;
+          }
+
+          // texels that were already projected by a view that faced them more directly win
+          if (FaceDot <= Weights[PixelIndex])
+          {
+            return;
+          }
+
+          if
+          (
+            RenderData->bPreserveExisting &&
+            Weights[PixelIndex] <= 0.0f &&
+            Pixels[PixelIndex].A >= RenderData->PreserveThreshold
+          )
+          {
+            return;
+          }
+
+          // find the local position of the pixel
+          FVector LocalPosition = Barycentric.X * Vertex0 + Barycentric.Y * Vertex1 + Barycentric.Z * Vertex2;
+          FVector WorldPosition = State.ActorTransform.TransformPosition(LocalPosition);
+
+          // project the world position to screen space
+          FPlane Result = ViewProjectionMatrix.TransformFVector4(FVector4(WorldPosition, 1.f));
+          if (Result.W <= 0.0f)
+          {
+            return;
+          }
+
+          // the result of this will be x and y coords in -1..1 projection space
+          const float Rhw = 1.0f / Result.W;
+          FPlane PosInScreenSpace = FPlane(Result.X * Rhw, Result.Y * Rhw, Result.Z * Rhw, Result.W);
+
+          // Move from projection space to normalized 0..1 UI space
+          FVector2D Uv
+          (
+            (PosInScreenSpace.X / 2.f) + 0.5f,
+            1.f - (PosInScreenSpace.Y / 2.f) - 0.5f
+          );
+
+          if (Uv.X < 0.0f || Uv.X > 1.0f || Uv.Y < 0.0f || Uv.Y > 1.0f)
+          {
+            return;
+          }
+
+          // calculate the pixel coordinates
+          int PixelX = FMath::FloorToInt(Uv.X * (DepthPyramid.GetWidth() - 1));
+          int PixelY = FMath::FloorToInt(Uv.Y * (DepthPyramid.GetHeight() - 1));
+
+          // the actor ids are rasterized on the cpu and can disagree with the captured depth at silhouettes and
+          // contact edges, so a texel on another actor is not rejected outright but has to pass the depth test
+          bool bTestDepth = bTestTexelDepth;
+          if (bHasActorIds && RenderData->ActorIds[PixelX + PixelY * DepthPyramid.GetWidth()] != State.ActorIndex)
+          {
+            bTestDepth = true;
+          }
+
+          if (bTestDepth)
+          {
+            float OccluderDepth = GetOccluderDepth(DepthPyramid.GetDepth(PixelX, PixelY));
+
+            if (bPerspective)
+            {
+              FVector ViewSpacePoint = ViewMatrix.TransformPosition(WorldPosition);
+
+              const float Eps = 5.0f;
+              if (ViewSpacePoint.Z > OccluderDepth + Eps)
+              {
+                return;
+              }
+            }
+            else
+            {
+              const float Eps = 0.01f;
+              if (PosInScreenSpace.Z < OccluderDepth - Eps)
+              {
+                return;
+              }
+            }
+          }
+
+          // get the pixel color from the input texture
+          FLinearColor Pixel = SampleBilinear((const FColor*)RenderData->OutputPixels.GetData(), RenderData->OutputWidth,
+            RenderData->OutputHeight, Uv);
+          Pixel.A = FMath::Clamp(FMath::Abs(FaceDot), 0.0f, 1.0f);
+          Pixel *= 255.0f;
+          Pixels[PixelIndex] = FColor(Pixel.R, Pixel.G, Pixel.B, Pixel.A);
+          Weights[PixelIndex] = FaceDot;
+        });
     }
   }
+
+  ExpandTextureIslands(Pixels, Width, Height, GutterWidth);
+}
+
+// transient texture shown while the full resolution bake is running
+static UTexture2D* CreatePreviewTexture(const TArray<FColor>& Pixels, int Width, int Height, bool bSRGB)
+{
+  UTexture2D* Texture = UTexture2D::CreateTransient(Width, Height, PF_B8G8R8A8);
+  if (Texture == nullptr)
+  {
+    return nullptr;
+  }
+
+  FTexture2DMipMap& Mip = Texture->GetPlatformData()->Mips[0];
+  void* MipData = Mip.BulkData.Lock(LOCK_READ_WRITE);
+  FMemory::Memcpy(MipData, Pixels.GetData(), Pixels.Num() * sizeof(FColor));
+  Mip.BulkData.Unlock();
+
+  Texture->SRGB = bSRGB;
+  Texture->UpdateResource();
+  return Texture;
 }
 
 bool UComfyTexturesWidgetBase::ProcessRenderResultForActor(AActor* Actor, TFunction<void(bool)> Callback)
@@ -580,31 +1101,20 @@ bool UComfyTexturesWidgetBase::ProcessRenderResultForActor(AActor* Actor, TFunct
 
   const FStaticMeshLODResources& MeshLod = StaticMesh->GetLODForExport(0);
 
-  struct SharedData
-  {
-    TArray<uint32> Indices;
-    TArray<FVector> Vertices;
-    TArray<FVector2D> Uvs;
-    TSharedPtr<TArray<FColor>> Pixels;
-    FComfyTexturesRenderDataPtr RenderData;
-    FTransform ActorTransform;
-    UTexture2D* Texture2D;
-    AActor* Actor;
-    int TextureWidth;
-    int TextureHeight;
-  };
-
-  TSharedPtr<SharedData> StateData = MakeShared<SharedData>();
-  StateData->RenderData = RenderQueue.begin().Value();
+  TSharedPtr<FBakeState> StateData = MakeShared<FBakeState>();
+  RenderQueue.GenerateValueArray(StateData->RenderData);
   StateData->ActorTransform = ActorTransform;
   StateData->TextureWidth = TextureWidth;
   StateData->TextureHeight = TextureHeight;
   StateData->Texture2D = Texture2D;
+  StateData->MaterialInstance = Cast<UMaterialInstanceDynamic>(Material);
   StateData->Actor = Actor;
+  StateData->ActorIndex = ActorSet.IndexOfByKey(Actor);
+  StateData->GutterWidth = GetMutableDefault<UComfyTexturesSettings>()->BakeGutterWidth;
   StateData->Pixels = MakeShared<TArray<FColor>>();
   StateData->Pixels->SetNumZeroed(TextureWidth * TextureHeight);
 
-  if (StateData->RenderData->bPreserveExisting)
+  if (StateData->RenderData[0]->bPreserveExisting)
   {
     FColor* MipData = (FColor*)Texture2D->Source.LockMip(0);
     if (MipData == nullptr)
@@ -633,140 +1143,59 @@ bool UComfyTexturesWidgetBase::ProcessRenderResultForActor(AActor* Actor, TFunct
     StateData->Uvs[VertexIndex] = Uv;
   }
 
-  AsyncTask(ENamedThreads::AnyBackgroundThreadNormalTask, [StateData, Callback]()
-    {
-      const FMinimalViewInfo& ViewInfo = StateData->RenderData->ViewInfo;
-      const FMatrix& ViewMatrix = StateData->RenderData->ViewMatrix;
-      const FMatrix& ProjectionMatrix = StateData->RenderData->ProjectionMatrix;
-
-      FMatrix ViewProjectionMatrix = ViewMatrix * ProjectionMatrix;
-      FIntRect ViewRect(0, 0, StateData->RenderData->OutputWidth, StateData->RenderData->OutputHeight);
-
-      // Iterate over the faces
-      for (int32 FaceIndex = 0; FaceIndex < StateData->Indices.Num(); FaceIndex += 3)
-      {
-        // Each face is represented by 3 indices
-        uint32 Index0 = StateData->Indices[FaceIndex];
-        uint32 Index1 = StateData->Indices[FaceIndex + 1];
-        uint32 Index2 = StateData->Indices[FaceIndex + 2];
-
-        // get the vertices of the face
-        const FVector& Vertex0 = StateData->Vertices[Index0];
-        const FVector& Vertex1 = StateData->Vertices[Index1];
-        const FVector& Vertex2 = StateData->Vertices[Index2];
+  // a quarter resolution bake is shown on the material first, the full bake replaces it when it is done
+  if (StateData->MaterialInstance.IsValid() && GetMutableDefault<UComfyTexturesSettings>()->bPreviewBake)
+  {
+    int PreviewWidth = FMath::Max(TextureWidth / 4, 1);
+    int PreviewHeight = FMath::Max(TextureHeight / 4, 1);
 
-        FVector FaceNormal = -FVector::CrossProduct(Vertex1 - Vertex0, Vertex2 - Vertex0).GetSafeNormal();
-        FVector FaceNormalWorld = StateData->ActorTransform.TransformVector(FaceNormal);
+    // the existing texels are scaled down here because the full bake overwrites them
+    TArray<FColor> PreviewPixels;
+    PreviewPixels.SetNumZeroed(PreviewWidth * PreviewHeight);
 
-        float FaceDot = 0.0f;
-        if (ViewInfo.ProjectionMode == ECameraProjectionMode::Perspective)
-        {
-          FVector Vertex0World = StateData->ActorTransform.TransformPosition(Vertex0);
-          FaceDot = FVector::DotProduct(FaceNormalWorld, (ViewInfo.Location - Vertex0World).GetSafeNormal());
-        }
-        else if (ViewInfo.ProjectionMode == ECameraProjectionMode::Orthographic)
-        {
-          // get forward vector of viewinfo
-          FVector Forward = ViewInfo.Rotation.Vector();
-          FaceDot = FVector::DotProduct(FaceNormalWorld, -Forward);
-        }
-
-        if (FaceDot <= 0.0f)
-        {
-          continue;
-        }
+    // alpha is kept so that unbaked and gutter texels stay open to the new projection,
+    // the texels are filtered in the color space of the texture
+    if (StateData->RenderData[0]->bPreserveExisting)
+    {
+      FImageUtils::ImageResize(TextureWidth, TextureHeight, *StateData->Pixels, PreviewWidth, PreviewHeight, PreviewPixels, !Texture2D->SRGB, false);
+    }
 
-        // get the UVs of the face
-        const FVector2D& Uv0 = StateData->Uvs[Index0];
-        const FVector2D& Uv1 = StateData->Uvs[Index1];
-        const FVector2D& Uv2 = StateData->Uvs[Index2];
+    // high priority so that the previews of all actors do not wait behind the full bakes of earlier actors
+    AsyncTask(ENamedThreads::AnyHiPriThreadHiPriTask, [StateData, PreviewPixels = MoveTemp(PreviewPixels), PreviewWidth, PreviewHeight]() mutable
+      {
+        BakeRenderResults(*StateData, PreviewPixels, PreviewWidth, PreviewHeight, FMath::DivideAndRoundUp(StateData->GutterWidth, 4));
 
-        RasterizeTriangle(Uv0, Uv1, Uv2, StateData->TextureWidth, StateData->TextureHeight, [&](int X, int Y, const FVector& Barycentric)
+        AsyncTask(ENamedThreads::GameThread, [StateData, PreviewPixels = MoveTemp(PreviewPixels), PreviewWidth, PreviewHeight]()
           {
-            int PixelIndex = X + Y * StateData->TextureWidth;
-            if (PixelIndex < 0 || PixelIndex >= StateData->Pixels->Num())
-            {
-              return;
-            }
-
-            if
-            (
-              StateData->RenderData->bPreserveExisting &&
-              (*StateData->Pixels)[PixelIndex].A >= StateData->RenderData->PreserveThreshold
-            )
-            {
-              return;
-            }
-
-            // find the local position of the pixel
-            FVector LocalPosition = Barycentric.X * Vertex0 + Barycentric.Y * Vertex1 + Barycentric.Z * Vertex2;
-            FVector WorldPosition = StateData->ActorTransform.TransformPosition(LocalPosition);
-
-            // project the world position to screen space
-            FPlane Result = ViewProjectionMatrix.TransformFVector4(FVector4(WorldPosition, 1.f));
-            if (Result.W <= 0.0f)
+            UMaterialInstanceDynamic* MaterialInstance = StateData->MaterialInstance.Get();
+            if (StateData->bBakeFinished || !IsValid(MaterialInstance))
             {
               return;
             }
 
-            // the result of this will be x and y coords in -1..1 projection space
-            const float Rhw = 1.0f / Result.W;
-            FPlane PosInScreenSpace = FPlane(Result.X * Rhw, Result.Y * Rhw, Result.Z * Rhw, Result.W);
-
-            // Move from projection space to normalized 0..1 UI space
-            FVector2D Uv
-            (
-              (PosInScreenSpace.X / 2.f) + 0.5f,
-              1.f - (PosInScreenSpace.Y / 2.f) - 0.5f
-            );
-
-            if (Uv.X < 0.0f || Uv.X > 1.0f || Uv.Y < 0.0f || Uv.Y > 1.0f)
+            UTexture2D* PreviewTexture = CreatePreviewTexture(PreviewPixels, PreviewWidth, PreviewHeight, StateData->Texture2D->SRGB);
+            if (PreviewTexture != nullptr)
             {
-              return;
+              MaterialInstance->SetTextureParameterValue(TEXT("BaseColor"), PreviewTexture);
             }
-
-            const FComfyTexturesImageData& RawDepth = StateData->RenderData->RawDepth;
-
-            // calculate the pixel coordinates
-            int PixelX = FMath::FloorToInt(Uv.X * (RawDepth.Width - 1));
-            int PixelY = FMath::FloorToInt(Uv.Y * (RawDepth.Height - 1));
-
-            float ClosestDepth = RawDepth.Pixels[PixelX + PixelY * RawDepth.Width].R;
-
-            if (ViewInfo.ProjectionMode == ECameraProjectionMode::Perspective)
-            {
-              FVector ViewSpacePoint = ViewMatrix.TransformPosition(WorldPosition);
-
-              const float Eps = 5.0f;
-              if (ViewSpacePoint.Z > ClosestDepth + Eps)
-              {
-                return;
-              }
-            }
-            else
-            {
-              FVector4 ClipSpacePoint = ProjectionMatrix.TransformFVector4(FVector4(0.0f, 0.0f, ClosestDepth, 1.0f));
-              float ClipSpaceDepth = ClipSpacePoint.Z / ClipSpacePoint.W;
-              const float Eps = 0.01f;
-              if (PosInScreenSpace.Z < ClipSpaceDepth - Eps)
-              {
-                return;
-              }
-            }
-
-            // get the pixel color from the input texture
-            FLinearColor Pixel = SampleBilinear(StateData->RenderData->OutputPixels, StateData->RenderData->OutputWidth,
-              StateData->RenderData->OutputHeight, Uv);
-            Pixel.A = FMath::Clamp(FMath::Abs(FaceDot), 0.0f, 1.0f);
-            Pixel *= 255.0f;
-            (*StateData->Pixels)[PixelIndex] = FColor(Pixel.R, Pixel.G, Pixel.B, Pixel.A);
           });
-      }
+      });
+  }
 
-      ExpandTextureIslands(*StateData->Pixels, StateData->TextureWidth, StateData->TextureHeight, 4);
+  AsyncTask(ENamedThreads::AnyBackgroundThreadNormalTask, [StateData, Callback]()
+    {
+      BakeRenderResults(*StateData, *StateData->Pixels, StateData->TextureWidth, StateData->TextureHeight, StateData->GutterWidth);
 
       AsyncTask(ENamedThreads::GameThread, [StateData, Callback]()
         {
+          StateData->bBakeFinished = true;
+
+          UMaterialInstanceDynamic* MaterialInstance = StateData->MaterialInstance.Get();
+          if (IsValid(MaterialInstance))
+          {
+            MaterialInstance->SetTextureParameterValue(TEXT("BaseColor"), StateData->Texture2D);
+          }
+
           UKismetSystemLibrary::TransactObject(StateData->Texture2D);
 
           FColor* MipData = (FColor*)StateData->Texture2D->Source.LockMip(0);
@@ -1047,6 +1476,146 @@ static bool GetNodeInputProperty(FJsonObject& Workflow, const FString& NodeName,
   return false;
 }
 
+// rewires the input image nodes of a workflow to read from the two packed upload images, every input node is
+// replaced in place by the node that extracts it so the links to it stay valid
+static void UnpackWorkflowInputs(FJsonObject& Workflow, const FString& DataFilename, const FString& ViewsFilename, int ViewSize)
+{
+  int NextNodeId = 1;
+  for (const TPair<FString, TSharedPtr<FJsonValue>>& Node : Workflow.Values)
+  {
+    NextNodeId = FMath::Max(NextNodeId, FCString::Atoi(*Node.Key) + 1);
+  }
+
+  auto AddNode = [&Workflow, &NextNodeId](const FString& ClassType, const TSharedPtr<FJsonObject>& Inputs)
+    {
+      TSharedPtr<FJsonObject> Node = MakeShared<FJsonObject>();
+      Node->SetObjectField("inputs", Inputs);
+      Node->SetStringField("class_type", ClassType);
+
+      FString NodeId = FString::FromInt(NextNodeId++);
+      Workflow.SetObjectField(NodeId, Node);
+      return NodeId;
+    };
+
+  auto MakeLink = [](const FString& NodeId)
+    {
+      TArray<TSharedPtr<FJsonValue>> Link;
+      Link.Add(MakeShared<FJsonValueString>(NodeId));
+      Link.Add(MakeShared<FJsonValueNumber>(0));
+      return Link;
+    };
+
+  auto AddLoadImageNode = [&AddNode](const FString& Filename)
+    {
+      TSharedPtr<FJsonObject> Inputs = MakeShared<FJsonObject>();
+      Inputs->SetStringField("image", Filename);
+      Inputs->SetStringField("upload", "image");
+      return AddNode("LoadImage", Inputs);
+    };
+
+  FString DataNodeId = AddLoadImageNode(DataFilename);
+  FString ViewsNodeId = AddLoadImageNode(ViewsFilename);
+
+  // depth, edge and mask are single channels of the data image
+  TArray<TPair<FString, FString>> Channels = { { "input_depth", "red" }, { "input_edge", "green" }, { "input_mask", "blue" } };
+
+  for (const TPair<FString, FString>& Channel : Channels)
+  {
+    TArray<TSharedPtr<FJsonObject>> Nodes = FindNodesByTitle(Workflow, Channel.Key);
+    if (Nodes.Num() == 0)
+    {
+      continue;
+    }
+
+    TSharedPtr<FJsonObject> MaskInputs = MakeShared<FJsonObject>();
+    MaskInputs->SetArrayField("image", MakeLink(DataNodeId));
+    MaskInputs->SetStringField("channel", Channel.Value);
+    FString MaskNodeId = AddNode("ImageToMask", MaskInputs);
+
+    for (TSharedPtr<FJsonObject>& Node : Nodes)
+    {
+      TSharedPtr<FJsonObject> Inputs = MakeShared<FJsonObject>();
+      Inputs->SetArrayField("mask", MakeLink(MaskNodeId));
+      Node->SetObjectField("inputs", Inputs);
+      Node->SetStringField("class_type", "MaskToImage");
+    }
+  }
+
+  // normals are the left half of the views image and color the right half
+  TArray<TPair<FString, int>> Crops = { { "input_normals", 0 }, { "input_color", ViewSize } };
+
+  for (const TPair<FString, int>& Crop : Crops)
+  {
+    for (TSharedPtr<FJsonObject>& Node : FindNodesByTitle(Workflow, Crop.Key))
+    {
+      TSharedPtr<FJsonObject> Inputs = MakeShared<FJsonObject>();
+      Inputs->SetArrayField("image", MakeLink(ViewsNodeId));
+      Inputs->SetNumberField("width", ViewSize);
+      Inputs->SetNumberField("height", ViewSize);
+      Inputs->SetNumberField("x", Crop.Value);
+      Inputs->SetNumberField("y", 0);
+      Node->SetObjectField("inputs", Inputs);
+      Node->SetStringField("class_type", "ImageCrop");
+    }
+  }
+}
+
+// scales the images of every SaveImage node to Size, a node titled output_resize is used instead when the workflow has one
+static void ResizeWorkflowOutput(FJsonObject& Workflow, int Size)
+{
+  TArray<TSharedPtr<FJsonObject>> ResizeNodes = FindNodesByTitle(Workflow, "output_resize");
+  if (ResizeNodes.Num() > 0)
+  {
+    SetNodeInputProperty(Workflow, "output_resize", "width", Size);
+    SetNodeInputProperty(Workflow, "output_resize", "height", Size);
+    return;
+  }
+
+  int NextNodeId = 1;
+  TArray<TSharedPtr<FJsonObject>> SaveNodes;
+
+  for (const TPair<FString, TSharedPtr<FJsonValue>>& Node : Workflow.Values)
+  {
+    NextNodeId = FMath::Max(NextNodeId, FCString::Atoi(*Node.Key) + 1);
+
+    const TSharedPtr<FJsonObject>* NodeObject = nullptr;
+    FString ClassType;
+    if (Node.Value->TryGetObject(NodeObject) && (*NodeObject)->TryGetStringField("class_type", ClassType) && ClassType == "SaveImage")
+    {
+      SaveNodes.Add(*NodeObject);
+    }
+  }
+
+  for (TSharedPtr<FJsonObject>& SaveNode : SaveNodes)
+  {
+    const TSharedPtr<FJsonObject>* SaveInputs = nullptr;
+    const TArray<TSharedPtr<FJsonValue>>* ImageLink = nullptr;
+    if (!SaveNode->TryGetObjectField("inputs", SaveInputs) || !(*SaveInputs)->TryGetArrayField("images", ImageLink))
+    {
+      continue;
+    }
+
+    TSharedPtr<FJsonObject> Inputs = MakeShared<FJsonObject>();
+    Inputs->SetArrayField("image", *ImageLink);
+    Inputs->SetStringField("upscale_method", "area");
+    Inputs->SetNumberField("width", Size);
+    Inputs->SetNumberField("height", Size);
+    Inputs->SetStringField("crop", "disabled");
+
+    TSharedPtr<FJsonObject> Node = MakeShared<FJsonObject>();
+    Node->SetObjectField("inputs", Inputs);
+    Node->SetStringField("class_type", "ImageScale");
+
+    FString NodeId = FString::FromInt(NextNodeId++);
+    Workflow.SetObjectField(NodeId, Node);
+
+    TArray<TSharedPtr<FJsonValue>> Link;
+    Link.Add(MakeShared<FJsonValueString>(NodeId));
+    Link.Add(MakeShared<FJsonValueNumber>(0));
+    (*SaveInputs)->SetArrayField("images", Link);
+  }
+}
+
 bool UComfyTexturesWidgetBase::QueueRender(const FComfyTexturesRenderOptions& RenderOpts, int& RequestIndex)
 {
   if (!IsConnected())
@@ -1110,11 +1679,23 @@ bool UComfyTexturesWidgetBase::QueueRender(const FComfyTexturesRenderOptions& Re
   SetNodeInputProperty(*Workflow, "control_depth", "strength", RenderOpts.Params.ControlDepthStrength);
   SetNodeInputProperty(*Workflow, "control_canny", "strength", RenderOpts.Params.ControlCannyStrength);
 
-  SetNodeInputProperty(*Workflow, "input_depth", "image", RenderOpts.DepthImageFilename);
-  SetNodeInputProperty(*Workflow, "input_normals", "image", RenderOpts.NormalsImageFilename);
-  SetNodeInputProperty(*Workflow, "input_color", "image", RenderOpts.ColorImageFilename);
-  SetNodeInputProperty(*Workflow, "input_mask", "image", RenderOpts.MaskImageFilename);
-  SetNodeInputProperty(*Workflow, "input_edge", "image", RenderOpts.EdgeMaskImageFilename);
+  if (RenderOpts.PackedDataImageFilename.IsEmpty())
+  {
+    SetNodeInputProperty(*Workflow, "input_depth", "image", RenderOpts.DepthImageFilename);
+    SetNodeInputProperty(*Workflow, "input_normals", "image", RenderOpts.NormalsImageFilename);
+    SetNodeInputProperty(*Workflow, "input_color", "image", RenderOpts.ColorImageFilename);
+    SetNodeInputProperty(*Workflow, "input_mask", "image", RenderOpts.MaskImageFilename);
+    SetNodeInputProperty(*Workflow, "input_edge", "image", RenderOpts.EdgeMaskImageFilename);
+  }
+  else
+  {
+    UnpackWorkflowInputs(*Workflow, RenderOpts.PackedDataImageFilename, RenderOpts.PackedViewsImageFilename, RenderOpts.PackedViewSize);
+  }
+
+  if (RenderOpts.OutputSize > 0)
+  {
+    ResizeWorkflowOutput(*Workflow, RenderOpts.OutputSize);
+  }
 
   TSharedPtr<FJsonObject> Payload = MakeShared<FJsonObject>();
   Payload->SetStringField("client_id", HttpClient->ClientId);
@@ -1852,7 +2433,7 @@ void UComfyTexturesWidgetBase::HandleWebSocketMessage(const TSharedPtr<FJsonObje
   }
 }
 
-bool UComfyTexturesWidgetBase::ReadRenderTargetPixels(UTextureRenderTarget2D* InputTexture, EComfyTexturesRenderTextureMode Mode, FComfyTexturesImageData& OutImage) const
+bool UComfyTexturesWidgetBase::ReadRenderTargetPixels(UTextureRenderTarget2D* InputTexture, EComfyTexturesRenderTextureMode Mode, int Downsample, FComfyTexturesImageData& OutImage) const
 {
   if (InputTexture == nullptr)
   {
@@ -1872,136 +2453,730 @@ bool UComfyTexturesWidgetBase::ReadRenderTargetPixels(UTextureRenderTarget2D* In
     return false;
   }
 
-  OutImage.Width = InputTexture->SizeX;
-  OutImage.Height = InputTexture->SizeY;
-  OutImage.Pixels.SetNum(Pixels.Num());
+  // every output pixel is the average of a Downsample x Downsample block of source pixels
+  Downsample = FMath::Max(Downsample, 1);
+  const int SourceWidth = InputTexture->SizeX;
+  const float BlockWeight = 1.0f / (float)(Downsample * Downsample);
+
+  OutImage.Width = InputTexture->SizeX / Downsample;
+  OutImage.Height = InputTexture->SizeY / Downsample;
+  OutImage.Pixels.SetNumUninitialized(OutImage.Width * OutImage.Height);
+
+  // every output row is converted independently, each source pixel is four halfs that are converted in one go
+  const uint16* SourceData = (const uint16*)Pixels.GetData();
+
+  auto LoadSource = [SourceData, SourceWidth, Downsample](int X, int Y, int SubX, int SubY)
+    {
+      return VectorLoadHalf(SourceData + ((Y * Downsample + SubY) * SourceWidth + X * Downsample + SubX) * 4);
+    };
+
+  const VectorRegister4Float Zero = VectorZeroFloat();
+  const VectorRegister4Float One = VectorSetFloat1(1.0f);
 
   if (Mode == EComfyTexturesRenderTextureMode::Depth)
   {
+    // the min max reduction runs in bands of source rows, background pixels at the half float maximum are ignored
+    const int NumSourceRows = InputTexture->SizeY;
+    const int NumBands = FMath::DivideAndRoundUp(NumSourceRows, 16);
+
+    TArray<float> BandMin;
+    TArray<float> BandMax;
+    BandMin.Init(FLT_MAX, NumBands);
+    BandMax.Init(-FLT_MAX, NumBands);
+
+    ParallelFor(NumBands, [&](int Band)
+      {
+        const VectorRegister4Float Background = VectorSetFloat1(65504.0f);
+        const VectorRegister4Float Largest = VectorSetFloat1(FLT_MAX);
+        const VectorRegister4Float Smallest = VectorSetFloat1(-FLT_MAX);
+
+        VectorRegister4Float MinVec = Largest;
+        VectorRegister4Float MaxVec = Smallest;
+
+        int EndIndex = FMath::Min((Band + 1) * 16, NumSourceRows) * SourceWidth;
+        for (int Index = Band * 16 * SourceWidth; Index < EndIndex; Index++)
+        {
+          VectorRegister4Float Depth = VectorReplicate(VectorLoadHalf(SourceData + Index * 4), 3);
+          VectorRegister4Float Valid = VectorCompareLT(Depth, Background);
+
+          MinVec = VectorMin(MinVec, VectorSelect(Valid, Depth, Largest));
+          MaxVec = VectorMax(MaxVec, VectorSelect(Valid, Depth, Smallest));
+        }
+
+        BandMin[Band] = VectorGetComponent(MinVec, 0);
+        BandMax[Band] = VectorGetComponent(MaxVec, 0);
+      });
+
     float MinDepth = FLT_MAX;
     float MaxDepth = -FLT_MAX;
 
-    for (int Index = 0; Index < Pixels.Num(); Index++)
+    for (int Band = 0; Band < NumBands; Band++)
     {
-      float Depth = Pixels[Index].A;
-      if (Depth >= 65504.0f)
+      MinDepth = FMath::Min(MinDepth, BandMin[Band]);
+      MaxDepth = FMath::Max(MaxDepth, BandMax[Band]);
+    }
+
+    // near is white and far is black, a flat depth range maps every valid pixel to white,
+    // background stays black, which also covers a capture without any valid pixels
+    const float DepthScale = MaxDepth > MinDepth ? 1.0f / (MaxDepth - MinDepth) : 0.0f;
+    const VectorRegister4Float Background = VectorSetFloat1(65504.0f);
+    const VectorRegister4Float MinVec = VectorSetFloat1(MinDepth);
+    const VectorRegister4Float ScaleVec = VectorSetFloat1(DepthScale);
+    const VectorRegister4Float WeightVec = VectorSetFloat1(BlockWeight);
+
+    ParallelFor(OutImage.Height, [&](int Y)
       {
-        continue;
+        for (int X = 0; X < OutImage.Width; X++)
+        {
+          VectorRegister4Float DepthSum = Zero;
+
+          for (int SubY = 0; SubY < Downsample; SubY++)
+          {
+            for (int SubX = 0; SubX < Downsample; SubX++)
+            {
+              VectorRegister4Float RawDepth = VectorReplicate(LoadSource(X, Y, SubX, SubY), 3);
+              VectorRegister4Float Depth = VectorMultiply(VectorSubtract(RawDepth, MinVec), ScaleVec);
+              Depth = VectorSubtract(One, VectorMin(VectorMax(Depth, Zero), One));
+              DepthSum = VectorAdd(DepthSum, VectorSelect(VectorCompareLT(RawDepth, Background), Depth, Zero));
+            }
+          }
+
+          VectorStore(VectorSet_W1(VectorMultiply(DepthSum, WeightVec)), &OutImage.Pixels[Y * OutImage.Width + X].R);
+        }
+      });
+  }
+  else if (Mode == EComfyTexturesRenderTextureMode::RawDepth)
+  {
+    const VectorRegister4Float Largest = VectorSetFloat1(FLT_MAX);
+
+    ParallelFor(OutImage.Height, [&](int Y)
+      {
+        for (int X = 0; X < OutImage.Width; X++)
+        {
+          // keep the closest depth so the bake occlusion test stays conservative
+          VectorRegister4Float Depth = Largest;
+
+          for (int SubY = 0; SubY < Downsample; SubY++)
+          {
+            for (int SubX = 0; SubX < Downsample; SubX++)
+            {
+              Depth = VectorMin(Depth, VectorReplicate(LoadSource(X, Y, SubX, SubY), 3));
+            }
+          }
+
+          VectorStore(VectorSet_W1(Depth), &OutImage.Pixels[Y * OutImage.Width + X].R);
+        }
+      });
+  }
+  else if (Mode == EComfyTexturesRenderTextureMode::Normals)
+  {
+    const VectorRegister4Float Half = VectorSetFloat1(0.5f);
+    const VectorRegister4Float MinLengthSquared = VectorSetFloat1(UE_SMALL_NUMBER);
+
+    // same result as FVector::GetSafeNormal in single precision, zero when the vector is too short
+    auto SafeNormal = [Zero, MinLengthSquared](VectorRegister4Float Vector)
+      {
+        VectorRegister4Float LengthSquared = VectorDot3(Vector, Vector);
+        VectorRegister4Float Normal = VectorMultiply(Vector, VectorReciprocalSqrtAccurate(VectorMax(LengthSquared, MinLengthSquared)));
+        return VectorSelect(VectorCompareGT(LengthSquared, MinLengthSquared), Normal, Zero);
+      };
+
+    ParallelFor(OutImage.Height, [&](int Y)
+      {
+        for (int X = 0; X < OutImage.Width; X++)
+        {
+          VectorRegister4Float NormalSum = Zero;
+
+          for (int SubY = 0; SubY < Downsample; SubY++)
+          {
+            for (int SubX = 0; SubX < Downsample; SubX++)
+            {
+              NormalSum = VectorAdd(NormalSum, SafeNormal(VectorSet_W0(LoadSource(X, Y, SubX, SubY))));
+            }
+          }
+
+          VectorRegister4Float Normal = VectorMultiplyAdd(SafeNormal(NormalSum), Half, Half);
+          VectorStore(VectorSet_W1(Normal), &OutImage.Pixels[Y * OutImage.Width + X].R);
+        }
+      });
+  }
+  else if (Mode == EComfyTexturesRenderTextureMode::Color)
+  {
+    const VectorRegister4Float WeightVec = VectorSetFloat1(BlockWeight);
+
+    ParallelFor(OutImage.Height, [&](int Y)
+      {
+        for (int X = 0; X < OutImage.Width; X++)
+        {
+          VectorRegister4Float ColorSum = Zero;
+
+          for (int SubY = 0; SubY < Downsample; SubY++)
+          {
+            for (int SubX = 0; SubX < Downsample; SubX++)
+            {
+              ColorSum = VectorAdd(ColorSum, LoadSource(X, Y, SubX, SubY));
+            }
+          }
+
+          VectorStore(VectorSet_W1(VectorMultiply(ColorSum, WeightVec)), &OutImage.Pixels[Y * OutImage.Width + X].R);
+        }
+      });
+  }
+  else
+  {
+    UE_LOG(LogComfyTextures, Error, TEXT("Unknown render texture mode: %d"), (int)Mode);
+    return false;
+  }
+
+  return true;
+}
+
+// source pixels and weights that contribute to every target pixel along one axis
+struct FResampleTaps
+{
+  TArray<int> Start;
+  TArray<int> Count;
+  TArray<float> Weights;
+  int Stride = 0;
+};
+
+// area filter when downscaling and bilinear filter when upscaling
+static void ComputeResampleTaps(int SourceSize, int TargetSize, FResampleTaps& OutTaps)
+{
+  float Scale = (float)SourceSize / (float)TargetSize;
+
+  OutTaps.Stride = Scale > 1.0f ? FMath::CeilToInt(Scale) + 1 : 2;
+  OutTaps.Start.SetNumUninitialized(TargetSize);
+  OutTaps.Count.SetNumUninitialized(TargetSize);
+  OutTaps.Weights.SetNumZeroed(TargetSize * OutTaps.Stride);
+
+  for (int Target = 0; Target < TargetSize; Target++)
+  {
+    float* Weights = OutTaps.Weights.GetData() + Target * OutTaps.Stride;
+
+    if (Scale > 1.0f)
+    {
+      // weight every source pixel by how much of it the target pixel covers
+      float Begin = Target * Scale;
+      float End = Begin + Scale;
+      int First = FMath::FloorToInt(Begin);
+      int Last = FMath::Min(FMath::CeilToInt(End), SourceSize) - 1;
+
+      OutTaps.Start[Target] = First;
+      OutTaps.Count[Target] = Last - First + 1;
+
+      for (int Source = First; Source <= Last; Source++)
+      {
+        float Coverage = FMath::Min(End, (float)(Source + 1)) - FMath::Max(Begin, (float)Source);
+        Weights[Source - First] = FMath::Max(Coverage, 0.0f) / Scale;
+      }
+    }
+    else
+    {
+      float Center = (Target + 0.5f) * Scale - 0.5f;
+      int Source = FMath::FloorToInt(Center);
+      float Fraction = Center - Source;
+
+      if (Source < 0)
+      {
+        OutTaps.Start[Target] = 0;
+        OutTaps.Count[Target] = 1;
+        Weights[0] = 1.0f;
+      }
+      else if (Source + 1 >= SourceSize || Fraction <= KINDA_SMALL_NUMBER)
+      {
+        OutTaps.Start[Target] = FMath::Min(Source, SourceSize - 1);
+        OutTaps.Count[Target] = 1;
+        Weights[0] = 1.0f;
+      }
+      else
+      {
+        OutTaps.Start[Target] = Source;
+        OutTaps.Count[Target] = 2;
+        Weights[0] = 1.0f - Fraction;
+        Weights[1] = Fraction;
+      }
+    }
+  }
+}
+
+// streams target rows of a resized image, the horizontal pass of every source row is cached
+// for as long as the vertical filter of the following target rows still reads it
+struct FImageRowResampler
+{
+  const FComfyTexturesImageData* Source = nullptr;
+  int SourceX = 0;
+  FResampleTaps TapsX;
+  FResampleTaps TapsY;
+  TArray<FLinearColor> CachedRows;
+  TArray<int> CachedRowIndices;
+
+  // resamples the columns from FirstColumn to FirstColumn + NumColumns, the filter never reads outside of them
+  void Init(const FComfyTexturesImageData& Image, int FirstColumn, int NumColumns, int NewWidth, int NewHeight)
+  {
+    Source = &Image;
+    SourceX = FirstColumn;
+    ComputeResampleTaps(NumColumns, NewWidth, TapsX);
+    ComputeResampleTaps(Image.Height, NewHeight, TapsY);
+
+    // the taps of one target row cover at most Stride consecutive source rows, so they never share a slot
+    CachedRows.SetNumUninitialized(TapsY.Stride * NewWidth);
+    CachedRowIndices.Init(INDEX_NONE, TapsY.Stride);
+  }
+
+  const FLinearColor* GetHorizontalRow(int SourceY)
+  {
+    int Slot = SourceY % TapsY.Stride;
+    FLinearColor* Row = CachedRows.GetData() + Slot * TapsX.Start.Num();
+
+    if (CachedRowIndices[Slot] == SourceY)
+    {
+      return Row;
+    }
+
+    const FLinearColor* SourceRow = Source->Pixels.GetData() + SourceY * Source->Width + SourceX;
+
+    for (int X = 0; X < TapsX.Start.Num(); X++)
+    {
+      const FLinearColor* Pixels = SourceRow + TapsX.Start[X];
+      const float* Weights = TapsX.Weights.GetData() + X * TapsX.Stride;
+
+      VectorRegister4Float Sum = VectorZeroFloat();
+      for (int Tap = 0; Tap < TapsX.Count[X]; Tap++)
+      {
+        Sum = VectorMultiplyAdd(VectorLoad(&Pixels[Tap].R), VectorSetFloat1(Weights[Tap]), Sum);
+      }
+
+      VectorStore(Sum, &Row[X].R);
+    }
+
+    CachedRowIndices[Slot] = SourceY;
+    return Row;
+  }
+
+  void ResampleRow(int Y, FLinearColor* OutRow)
+  {
+    int Width = TapsX.Start.Num();
+    const float* Weights = TapsY.Weights.GetData() + Y * TapsY.Stride;
+
+    for (int X = 0; X < Width; X++)
+    {
+      VectorStore(VectorZeroFloat(), &OutRow[X].R);
+    }
+
+    for (int Tap = 0; Tap < TapsY.Count[Y]; Tap++)
+    {
+      const FLinearColor* Row = GetHorizontalRow(TapsY.Start[Y] + Tap);
+      VectorRegister4Float Weight = VectorSetFloat1(Weights[Tap]);
+
+      for (int X = 0; X < Width; X++)
+      {
+        VectorStore(VectorMultiplyAdd(VectorLoad(&Row[X].R), Weight, VectorLoad(&OutRow[X].R)), &OutRow[X].R);
+      }
+    }
+  }
+};
+
+// linear to 8 bit quantization tables indexed by the exponent and the top mantissa bits of the input,
+// relative precision is the same over the whole range so dark values keep all of their gamma levels
+struct FQuantizeTables
+{
+  // inputs below 2^-20 quantize to zero
+  static constexpr uint32 MinBits = 0x35800000;
+  static constexpr int MantissaShift = 15;
+  static constexpr int NumEntries = (20 << 8) + 1;
+
+  uint8 Gamma[NumEntries];
+  uint8 Linear[NumEntries];
+
+  FQuantizeTables()
+  {
+    for (int Index = 0; Index < NumEntries; Index++)
+    {
+      // center of the bucket, the last entry is exactly 1.0
+      uint32 Bits = MinBits + ((uint32)Index << MantissaShift) + (Index < NumEntries - 1 ? 1u << (MantissaShift - 1) : 0u);
+      float Value = FMath::Clamp(*(float*)&Bits, 0.0f, 1.0f);
+
+      Gamma[Index] = (uint8)FMath::RoundToInt(FMath::Pow(Value, 1.0f / 2.2f) * 255.0f);
+      Linear[Index] = (uint8)FMath::RoundToInt(Value * 255.0f);
+    }
+  }
+
+  static const FQuantizeTables& Get()
+  {
+    static const FQuantizeTables Tables;
+    return Tables;
+  }
+
+  static int GetIndex(float Value)
+  {
+    uint32 MinValueBits = MinBits;
+    float Clamped = FMath::Clamp(Value, *(float*)&MinValueBits, 1.0f);
+    return (*(uint32*)&Clamped >> MantissaShift) - (MinBits >> MantissaShift);
+  }
+};
+
+// converts linear pixels to 8 bit, gamma corrected color and linear alpha if the output has an alpha channel
+template<int Channels>
+static void QuantizeRowColor8(const FLinearColor* Pixels, int Width, uint8* OutRow)
+{
+  const FQuantizeTables& Tables = FQuantizeTables::Get();
+
+  const VectorRegister4Float MinValue = VectorSetFloat1(*(const float*)&FQuantizeTables::MinBits);
+  const VectorRegister4Float MaxValue = VectorSetFloat1(1.0f);
+  const VectorRegister4Int MinBits = VectorIntSet1(FQuantizeTables::MinBits >> FQuantizeTables::MantissaShift);
+
+  alignas(16) int32 Indices[4];
+
+  for (int X = 0; X < Width; X++)
+  {
+    VectorRegister4Float Pixel = VectorMin(VectorMax(VectorLoad(&Pixels[X].R), MinValue), MaxValue);
+    VectorRegister4Int Index = VectorIntSubtract(VectorShiftRightImmLogical(VectorCastFloatToInt(Pixel), FQuantizeTables::MantissaShift), MinBits);
+    VectorIntStoreAligned(Index, Indices);
+
+    uint8* OutPixel = OutRow + X * Channels;
+    OutPixel[0] = Tables.Gamma[Indices[0]];
+    OutPixel[1] = Tables.Gamma[Indices[1]];
+    OutPixel[2] = Tables.Gamma[Indices[2]];
+
+    if (Channels == 4)
+    {
+      OutPixel[3] = Tables.Linear[Indices[3]];
+    }
+  }
+}
+
+// converts the red channel of linear pixels to 8 bit gamma corrected grayscale
+static void QuantizeRowGray8(const FLinearColor* Pixels, int Width, uint8* OutRow)
+{
+  const FQuantizeTables& Tables = FQuantizeTables::Get();
+
+  for (int X = 0; X < Width; X++)
+  {
+    OutRow[X] = Tables.Gamma[FQuantizeTables::GetIndex(Pixels[X].R)];
+  }
+}
+
+// scales and rounds linear data to 8 bit without any transfer function, grayscale reads the red channel
+template<int Channels>
+static void QuantizeRowData8(const FLinearColor* Pixels, int Width, uint8* OutRow)
+{
+  const VectorRegister4Float Zero = VectorZeroFloat();
+  const VectorRegister4Float One = VectorSetFloat1(1.0f);
+  const VectorRegister4Float Scale = VectorSetFloat1(255.0f);
+  const VectorRegister4Float Half = VectorSetFloat1(0.5f);
+
+  alignas(16) int32 Values[4];
+
+  if (Channels == 1)
+  {
+    int X = 0;
+    for (; X + 4 <= Width; X += 4)
+    {
+      VectorRegister4Float Value = MakeVectorRegisterFloat(Pixels[X].R, Pixels[X + 1].R, Pixels[X + 2].R, Pixels[X + 3].R);
+      Value = VectorMultiplyAdd(VectorMin(VectorMax(Value, Zero), One), Scale, Half);
+      VectorIntStoreAligned(VectorFloatToInt(Value), Values);
+
+      OutRow[X + 0] = Values[0];
+      OutRow[X + 1] = Values[1];
+      OutRow[X + 2] = Values[2];
+      OutRow[X + 3] = Values[3];
+    }
+
+    for (; X < Width; X++)
+    {
+      OutRow[X] = (uint8)(FMath::Clamp(Pixels[X].R, 0.0f, 1.0f) * 255.0f + 0.5f);
+    }
+
+    return;
+  }
+
+  for (int X = 0; X < Width; X++)
+  {
+    VectorRegister4Float Value = VectorMultiplyAdd(VectorMin(VectorMax(VectorLoad(&Pixels[X].R), Zero), One), Scale, Half);
+    VectorIntStoreAligned(VectorFloatToInt(Value), Values);
+
+    uint8* OutPixel = OutRow + X * Channels;
+    for (int Channel = 0; Channel < Channels; Channel++)
+    {
+      OutPixel[Channel] = Values[Channel];
+    }
+  }
+}
+
+// writes 0 or 255 depending on which side of one half the value is, grayscale reads the red channel
+template<int Channels>
+static void QuantizeRowMask8(const FLinearColor* Pixels, int Width, uint8* OutRow)
+{
+  for (int X = 0; X < Width; X++)
+  {
+    const float* Pixel = &Pixels[X].R;
+    uint8* OutPixel = OutRow + X * Channels;
+
+    for (int Channel = 0; Channel < Channels; Channel++)
+    {
+      OutPixel[Channel] = Pixel[Channel] >= 0.5f ? 255 : 0;
+    }
+  }
+}
+
+// converts the red channel of linear pixels to 16 bit big endian grayscale, gamma corrected for colors
+template<bool bGamma>
+static void QuantizeRowGray16(const FLinearColor* Pixels, int Width, uint8* OutRow)
+{
+  for (int X = 0; X < Width; X++)
+  {
+    float Value = FMath::Clamp(Pixels[X].R, 0.0f, 1.0f);
+    if (bGamma)
+    {
+      Value = FMath::Pow(Value, 1.0f / 2.2f);
+    }
+
+    uint16 Value16 = FMath::RoundToInt(Value * 65535.0f);
+    OutRow[X * 2 + 0] = Value16 >> 8;
+    OutRow[X * 2 + 1] = Value16 & 0xFF;
+  }
+}
+
+typedef void (*FQuantizeRowFunction)(const FLinearColor*, int, uint8*);
+
+static FQuantizeRowFunction GetQuantizeRowFunction(int Channels, int BitDepth, EComfyTexturesEncodeProfile Profile)
+{
+  if (BitDepth == 16)
+  {
+    return Profile == EComfyTexturesEncodeProfile::Color ? QuantizeRowGray16<true> : QuantizeRowGray16<false>;
+  }
+
+  switch (Profile)
+  {
+  case EComfyTexturesEncodeProfile::Data:
+    return Channels == 1 ? QuantizeRowData8<1> : (Channels == 3 ? QuantizeRowData8<3> : QuantizeRowData8<4>);
+  case EComfyTexturesEncodeProfile::Mask:
+    return Channels == 1 ? QuantizeRowMask8<1> : (Channels == 3 ? QuantizeRowMask8<3> : QuantizeRowMask8<4>);
+  default:
+    return Channels == 1 ? QuantizeRowGray8 : (Channels == 3 ? QuantizeRowColor8<3> : QuantizeRowColor8<4>);
+  }
+}
+
+bool UComfyTexturesWidgetBase::EncodeUploadImage(const FComfyTexturesUploadImage& Upload, EComfyTexturesUploadCodec Codec, int Width, int Height, TArray64<uint8>& OutBytes) const
+{
+  const FComfyTexturesImageData& Image = Upload.Image;
+  EComfyTexturesUploadFormat Format = Upload.Format;
+
+  UE_LOG(LogComfyTextures, Verbose, TEXT("Encoding upload image with Width: %d, Height: %d"), Width, Height);
+
+  int NumPanels = FMath::Max(Upload.PanelProfiles.Num(), 1);
+
+  if (Image.Width <= 0 || Image.Height <= 0 || Width <= 0 || Height <= 0 || Width % NumPanels != 0 || Image.Width % NumPanels != 0)
+  {
+    UE_LOG(LogComfyTextures, Error, TEXT("Invalid image size for upload encoding."));
+    return false;
+  }
+
+  // depth and masks store the same value in every color channel and are written as grayscale
+  int Channels = 4;
+  int BitDepth = 8;
+
+  if (Format == EComfyTexturesUploadFormat::Rgb8)
+  {
+    Channels = 3;
+  }
+  else if (Format == EComfyTexturesUploadFormat::Gray8)
+  {
+    Channels = 1;
+  }
+  else if (Format == EComfyTexturesUploadFormat::Gray16)
+  {
+    Channels = 1;
+    BitDepth = 16;
+  }
+
+  // every panel of a packed image is resampled on its own so the filter does not mix neighbouring views,
+  // and quantized with its own profile
+  TArray<FQuantizeRowFunction, TInlineAllocator<2>> QuantizeRows;
+  for (int Panel = 0; Panel < NumPanels; Panel++)
+  {
+    QuantizeRows.Add(GetQuantizeRowFunction(Channels, BitDepth, Upload.PanelProfiles.Num() > 0 ? Upload.PanelProfiles[Panel] : Upload.Profile));
+  }
+
+  int RowSize = Width * Channels * BitDepth / 8;
+  int PanelWidth = Width / NumPanels;
+  int PanelRowSize = RowSize / NumPanels;
+
+  auto GetRows = [&Image, &QuantizeRows, Width, Height, RowSize, PanelWidth, PanelRowSize](int Y, int NumRows, uint8* OutRows)
+    {
+      int NumPanels = QuantizeRows.Num();
+      int SourcePanelWidth = Image.Width / NumPanels;
+
+      TArray<FImageRowResampler, TInlineAllocator<2>> Resamplers;
+      Resamplers.SetNum(NumPanels);
+      for (int Panel = 0; Panel < NumPanels; Panel++)
+      {
+        Resamplers[Panel].Init(Image, Panel * SourcePanelWidth, SourcePanelWidth, PanelWidth, Height);
+      }
+
+      TArray<FLinearColor> Row;
+      Row.SetNumUninitialized(Width);
+
+      for (int Index = 0; Index < NumRows; Index++)
+      {
+        for (int Panel = 0; Panel < NumPanels; Panel++)
+        {
+          FLinearColor* PanelRow = Row.GetData() + Panel * PanelWidth;
+          Resamplers[Panel].ResampleRow(Y + Index, PanelRow);
+          QuantizeRows[Panel](PanelRow, PanelWidth, OutRows + Index * RowSize + Panel * PanelRowSize);
+        }
       }
+    };
+
+  // only PNG can store 16 bit samples
+  if (Codec == EComfyTexturesUploadCodec::Png || BitDepth == 16)
+  {
+    UComfyTexturesSettings* Settings = GetMutableDefault<UComfyTexturesSettings>();
+
+    // every band of rows is resampled, converted and quantized straight into the encoder by the task compressing it
+    ComfyTexturesPngWriter Writer(Width, Height, Channels, BitDepth, Settings->PngCompression);
+    return Writer.Encode(GetRows, OutBytes);
+  }
 
-      MinDepth = FMath::Min(MinDepth, Depth);
-      MaxDepth = FMath::Max(MaxDepth, Depth);
-    }
+  TArray64<uint8> Pixels;
+  Pixels.SetNumUninitialized((int64)RowSize * Height);
 
-    for (int Index = 0; Index < Pixels.Num(); Index++)
+  const int RowsPerBand = 64;
+  ParallelFor(FMath::DivideAndRoundUp(Height, RowsPerBand), [&](int Band)
     {
-      float Depth = Pixels[Index].A;
-      Depth = FMath::Clamp(Depth, MinDepth, MaxDepth);
-      Depth = (Depth - MinDepth) / (MaxDepth - MinDepth);
-      Depth = FMath::Clamp(Depth, 0.0f, 1.0f);
-      Depth = 1.0f - Depth;
+      int FirstRow = Band * RowsPerBand;
+      GetRows(FirstRow, FMath::Min(RowsPerBand, Height - FirstRow), Pixels.GetData() + (int64)FirstRow * RowSize);
+    });
 
-      OutImage.Pixels[Index].R = Depth;
-      OutImage.Pixels[Index].G = Depth;
-      OutImage.Pixels[Index].B = Depth;
-      OutImage.Pixels[Index].A = 1.0f;
-    }
+  if (Codec == EComfyTexturesUploadCodec::Qoi)
+  {
+    return ComfyTexturesImageCodecs::EncodeQoi(Width, Height, Channels, Pixels.GetData(), OutBytes);
   }
-  else if (Mode == EComfyTexturesRenderTextureMode::RawDepth)
+
+  return ComfyTexturesImageCodecs::EncodeTga(Width, Height, Channels, Pixels.GetData(), OutBytes);
+}
+
+// true when the host of the url is a loopback name or address, ignores the scheme, credentials, port, path and query
+static bool IsLocalUrl(const FString& Url)
+{
+  FString Host = Url;
+
+  int SchemeEnd = Host.Find(TEXT("://"));
+  if (SchemeEnd != INDEX_NONE)
   {
-    for (int Index = 0; Index < Pixels.Num(); Index++)
-    {
-      float Depth = Pixels[Index].A;
-      OutImage.Pixels[Index].R = Depth;
-      OutImage.Pixels[Index].G = Depth;
-      OutImage.Pixels[Index].B = Depth;
-      OutImage.Pixels[Index].A = 1.0f;
-    }
+    Host.RightChopInline(SchemeEnd + 3);
   }
-  else if (Mode == EComfyTexturesRenderTextureMode::Normals)
+
+  int AuthorityEnd = Host.Len();
+  for (TCHAR Separator : { TEXT('/'), TEXT('?'), TEXT('#') })
   {
-    for (int Index = 0; Index < Pixels.Num(); Index++)
+    int SeparatorIndex;
+    if (Host.FindChar(Separator, SeparatorIndex))
     {
-      FVector Normal = FVector(Pixels[Index].R, Pixels[Index].G, Pixels[Index].B);
-      Normal = Normal.GetSafeNormal();
-      Normal = (Normal + 1.0f) / 2.0f;
-      OutImage.Pixels[Index].R = Normal.X;
-      OutImage.Pixels[Index].G = Normal.Y;
-      OutImage.Pixels[Index].B = Normal.Z;
-      OutImage.Pixels[Index].A = 1.0f;
+      AuthorityEnd = FMath::Min(AuthorityEnd, SeparatorIndex);
     }
   }
-  else if (Mode == EComfyTexturesRenderTextureMode::Color)
+  Host.LeftInline(AuthorityEnd);
+
+  int UserInfoEnd;
+  if (Host.FindLastChar(TEXT('@'), UserInfoEnd))
   {
-    for (int Index = 0; Index < Pixels.Num(); Index++)
-    {
-      OutImage.Pixels[Index].R = Pixels[Index].R;
-      OutImage.Pixels[Index].G = Pixels[Index].G;
-      OutImage.Pixels[Index].B = Pixels[Index].B;
-      OutImage.Pixels[Index].A = 1.0f;
-    }
+    Host.RightChopInline(UserInfoEnd + 1);
+  }
+
+  // bracketed ipv6 addresses end at the bracket, a bare address with several colons has no port
+  if (Host.StartsWith(TEXT("[")))
+  {
+    int BracketEnd;
+    Host = Host.FindChar(TEXT(']'), BracketEnd) ? Host.Mid(1, BracketEnd - 1) : Host.RightChop(1);
   }
   else
   {
-    UE_LOG(LogComfyTextures, Error, TEXT("Unknown render texture mode: %d"), (int)Mode);
-    return false;
+    int FirstColon;
+    int LastColon;
+    if (Host.FindChar(TEXT(':'), FirstColon) && Host.FindLastChar(TEXT(':'), LastColon) && FirstColon == LastColon)
+    {
+      Host.LeftInline(FirstColon);
+    }
   }
 
-  return true;
+  return Host.Equals(TEXT("localhost"), ESearchCase::IgnoreCase) || Host.StartsWith(TEXT("127.")) || Host == TEXT("::1");
 }
 
-bool UComfyTexturesWidgetBase::ConvertImageToPng(const FComfyTexturesImageData& Image, TArray64<uint8>& OutBytes) const
+EComfyTexturesUploadCodec UComfyTexturesWidgetBase::SelectUploadCodec() const
 {
-  UE_LOG(LogComfyTextures, Verbose, TEXT("Converting image to PNG with Width: %d, Height: %d"), Image.Width, Image.Height);
+  UComfyTexturesSettings* Settings = GetMutableDefault<UComfyTexturesSettings>();
 
-  TArray<FColor> Image8;
-  Image8.SetNum(Image.Pixels.Num());
-  for (int Index = 0; Index < Image.Pixels.Num(); Index++)
+  if (Settings->UploadCodec != EComfyTexturesUploadCodec::Automatic)
   {
-    FLinearColor Pixel = Image.Pixels[Index];
-    // convert from linear to sRGB
-    Pixel.R = FMath::Pow(Pixel.R, 1.0f / 2.2f);
-    Pixel.G = FMath::Pow(Pixel.G, 1.0f / 2.2f);
-    Pixel.B = FMath::Pow(Pixel.B, 1.0f / 2.2f);
+    return Settings->UploadCodec;
+  }
 
-    FColor OutPixel;
-    OutPixel.R = FMath::Clamp(Pixel.R, 0.0f, 1.0f) * 255.0f;
-    OutPixel.G = FMath::Clamp(Pixel.G, 0.0f, 1.0f) * 255.0f;
-    OutPixel.B = FMath::Clamp(Pixel.B, 0.0f, 1.0f) * 255.0f;
-    OutPixel.A = FMath::Clamp(Pixel.A, 0.0f, 1.0f) * 255.0f;
-    Image8[Index] = OutPixel;
+  // until an upload was measured assume that a server on this machine is fast
+  if (UploadThroughput <= 0.0)
+  {
+    return IsLocalUrl(Settings->ComfyUrl) ? EComfyTexturesUploadCodec::Tga : EComfyTexturesUploadCodec::Png;
   }
 
-  FImageUtils::PNGCompressImageArray(Image.Width, Image.Height, Image8, OutBytes);
-  return true;
-}
+  // the thresholds apply to uncompressed pixel bytes of whole batches over the time the link was busy, so they do not
+  // depend on the codec in use, raw bytes are cheapest when the link is faster than QOI encodes, QOI wins as long as
+  // the link is faster than deflate, slower links are worth the smaller PNG files
+  if (UploadThroughput >= 200.0 * 1024 * 1024)
+  {
+    return EComfyTexturesUploadCodec::Tga;
+  }
 
-bool UComfyTexturesWidgetBase::UploadImages(const TArray<FComfyTexturesImageData>& Images, const TArray<FString>& FileNames, TFunction<void(const TArray<FString>&, bool)> Callback) const
-{
-  if (Images.Num() != FileNames.Num())
+  if (UploadThroughput >= 20.0 * 1024 * 1024)
   {
-    UE_LOG(LogComfyTextures, Error, TEXT("Image and filename count do not match"));
-    Callback(TArray<FString>(), false);
-    return false;
+    return EComfyTexturesUploadCodec::Qoi;
   }
 
+  return EComfyTexturesUploadCodec::Png;
+}
+
+bool UComfyTexturesWidgetBase::UploadImages(TArray<FComfyTexturesUploadImage> Images, int TargetSize, TFunction<void(const TArray<FString>&, bool)> Callback) const
+{
   // Shared state for tracking task completion and results
   struct SharedState
   {
     int32 RemainingTasks;
     TArray<FString> ResultFileNames;
     FThreadSafeBool bAllSuccessful = true;
+
+    // the batch is measured as a whole, single uploads share the link and mostly time the latency,
+    // only the time from sending a request to its response counts so that encoding is not measured
+    FCriticalSection Lock;
+    TArray<TPair<double, double>> TransferIntervals;
+    int64 UploadedBytes = 0;
   };
   TSharedPtr<SharedState> StateData = MakeShared<SharedState>();
   StateData->RemainingTasks = Images.Num();
-  StateData->ResultFileNames.AddDefaulted(FileNames.Num());
+  StateData->ResultFileNames.AddDefaulted(Images.Num());
+
+  EComfyTexturesUploadCodec Codec = SelectUploadCodec();
 
   for (int32 Index = 0; Index < Images.Num(); ++Index)
   {
-    Async(EAsyncExecution::ThreadPool, [this, Image = Images[Index], FileName = FileNames[Index], StateData, Index, Callback]()
+    Async(EAsyncExecution::ThreadPool, [this, Upload = MoveTemp(Images[Index]), TargetSize, Codec, StateData, Index, Callback]()
       {
-        TArray64<uint8> PngData;
-        if (!ConvertImageToPng(Image, PngData))
+        TArray64<uint8> FileData;
+        // TargetSize is the height, packed images keep their aspect ratio
+        int TargetWidth = Upload.Image.Height > 0 ? TargetSize * Upload.Image.Width / Upload.Image.Height : TargetSize;
+
+        EComfyTexturesUploadCodec ImageCodec = Upload.Format == EComfyTexturesUploadFormat::Gray16 ? EComfyTexturesUploadCodec::Png : Codec;
+        FString FileName = Upload.FileName;
+
+        if (ImageCodec == EComfyTexturesUploadCodec::Tga)
+        {
+          FileName = FPaths::ChangeExtension(FileName, "tga");
+        }
+        else if (ImageCodec == EComfyTexturesUploadCodec::Qoi)
+        {
+          FileName = FPaths::ChangeExtension(FileName, "qoi");
+        }
+
+        if (!EncodeUploadImage(Upload, ImageCodec, TargetWidth, TargetSize, FileData))
         {
           StateData->bAllSuccessful = false;
           if (--StateData->RemainingTasks == 0)
@@ -2011,7 +3186,25 @@ bool UComfyTexturesWidgetBase::UploadImages(const TArray<FComfyTexturesImageData
           return;
         }
 
-        HttpClient->DoHttpFileUpload("upload/image", PngData, FileName, [StateData, Index, Callback](const TSharedPtr<FJsonObject>& Response, bool bWasSuccessful)
+        // uncompressed size of the pixels so that the measurement is the same for every codec
+        int BytesPerPixel = 4;
+        if (Upload.Format == EComfyTexturesUploadFormat::Rgb8)
+        {
+          BytesPerPixel = 3;
+        }
+        else if (Upload.Format == EComfyTexturesUploadFormat::Gray8)
+        {
+          BytesPerPixel = 1;
+        }
+        else if (Upload.Format == EComfyTexturesUploadFormat::Gray16)
+        {
+          BytesPerPixel = 2;
+        }
+
+        int64 RawSize = (int64)TargetWidth * TargetSize * BytesPerPixel;
+        double SendTime = FPlatformTime::Seconds();
+
+        HttpClient->DoHttpFileUpload("upload/image", FileData, FileName, [this, StateData, Index, Callback, RawSize, SendTime](const TSharedPtr<FJsonObject>& Response, bool bWasSuccessful)
           {
             if (!bWasSuccessful)
             {
@@ -2020,6 +3213,12 @@ bool UComfyTexturesWidgetBase::UploadImages(const TArray<FComfyTexturesImageData
             }
             else
             {
+              {
+                FScopeLock ScopeLock(&StateData->Lock);
+                StateData->UploadedBytes += RawSize;
+                StateData->TransferIntervals.Add({ SendTime, FPlatformTime::Seconds() });
+              }
+
               FString ResultFileName;
               if (Response->TryGetStringField("name", ResultFileName))
               {
@@ -2035,6 +3234,27 @@ bool UComfyTexturesWidgetBase::UploadImages(const TArray<FComfyTexturesImageData
             // Check if this is the last task
             if (--StateData->RemainingTasks == 0)
             {
+              // bytes of the whole batch over the union of the transfer intervals, overlapping uploads count once
+              if (StateData->bAllSuccessful)
+              {
+                FScopeLock ScopeLock(&StateData->Lock);
+
+                TArray<TPair<double, double>>& Intervals = StateData->TransferIntervals;
+                Intervals.Sort([](const TPair<double, double>& A, const TPair<double, double>& B) { return A.Key < B.Key; });
+
+                double TransferTime = 0.0;
+                double CoveredEnd = -DBL_MAX;
+                for (const TPair<double, double>& Interval : Intervals)
+                {
+                  double Begin = FMath::Max(Interval.Key, CoveredEnd);
+                  TransferTime += FMath::Max(Interval.Value - Begin, 0.0);
+                  CoveredEnd = FMath::Max(CoveredEnd, Interval.Value);
+                }
+
+                double Throughput = StateData->UploadedBytes / FMath::Max(TransferTime, 0.001);
+                UploadThroughput = UploadThroughput > 0.0 ? FMath::Lerp(UploadThroughput, Throughput, 0.25) : Throughput;
+              }
+
               Callback(StateData->ResultFileNames, StateData->bAllSuccessful);
             }
           });
@@ -2044,74 +3264,75 @@ bool UComfyTexturesWidgetBase::UploadImages(const TArray<FComfyTexturesImageData
   return true;
 }
 
-bool UComfyTexturesWidgetBase::DownloadImage(const FString& FileName, TFunction<void(TArray<FColor>, int, int, bool)> Callback) const
+// decodes straight into the returned buffer, the PNG wrapper hands over its own decoded data without copying it
+static bool DecodePngImage(const TArray<uint8>& PngData, TArray64<uint8>& OutPixels, int& OutWidth, int& OutHeight)
+{
+  // Create an image wrapper using the PNG format
+  IImageWrapperModule& ImageWrapperModule = FModuleManager::GetModuleChecked<IImageWrapperModule>(FName("ImageWrapper"));
+  TSharedPtr<IImageWrapper> ImageWrapper = ImageWrapperModule.CreateImageWrapper(EImageFormat::PNG);
+
+  // Set the compressed data for the image wrapper
+  if (!ImageWrapper.IsValid() || !ImageWrapper->SetCompressed(PngData.GetData(), PngData.Num()))
+  {
+    UE_LOG(LogComfyTextures, Error, TEXT("Failed to decompress image"));
+    return false;
+  }
+
+  // BGRA8 is the memory layout of FColor
+  if (!ImageWrapper->GetRaw(ERGBFormat::BGRA, 8, OutPixels))
+  {
+    UE_LOG(LogComfyTextures, Error, TEXT("Failed to decompress image"));
+    return false;
+  }
+
+  OutWidth = ImageWrapper->GetWidth();
+  OutHeight = ImageWrapper->GetHeight();
+
+  if (OutPixels.Num() != (int64)OutWidth * OutHeight * sizeof(FColor))
+  {
+    UE_LOG(LogComfyTextures, Error, TEXT("Decoded image has unexpected size"));
+    return false;
+  }
+
+  return true;
+}
+
+bool UComfyTexturesWidgetBase::DownloadImage(const FString& FileName, TFunction<void(TArray64<uint8>, int, int, bool)> Callback) const
 {
   FString Url = "view?filename=" + FileName;
 
   return HttpClient->DoHttpGetRequestRaw(Url, [Callback](const TArray<uint8>& PngData, bool bWasSuccessful)
     {
-      TArray<FColor> Pixels;
-
       if (!bWasSuccessful)
       {
         UE_LOG(LogComfyTextures, Error, TEXT("Failed to download image"));
-        Callback(Pixels, 0, 0, false);
+        Callback(TArray64<uint8>(), 0, 0, false);
         return;
       }
 
-      // Create an image wrapper using the PNG format
-      IImageWrapperModule& ImageWrapperModule = FModuleManager::LoadModuleChecked<IImageWrapperModule>(FName("ImageWrapper"));
-      TSharedPtr<IImageWrapper> ImageWrapper = ImageWrapperModule.CreateImageWrapper(EImageFormat::PNG);
+      // the response arrives on the game thread, decoding happens on a worker and only the pixels are posted back,
+      // the module is loaded here because modules can only be loaded from the game thread
+      FModuleManager::LoadModuleChecked<IImageWrapperModule>(FName("ImageWrapper"));
 
-      // Set the compressed data for the image wrapper
-      if (!ImageWrapper.IsValid() || !ImageWrapper->SetCompressed(PngData.GetData(), PngData.Num()))
-      {
-        UE_LOG(LogComfyTextures, Error, TEXT("Failed to decompress image"));
-        Callback(Pixels, 0, 0, false);
-        return;
-      }
-
-      // Decompress the image data
-      TArray<uint8> RawData;
-      if (!ImageWrapper->GetRaw(ERGBFormat::BGRA, 8, RawData))
-      {
-        UE_LOG(LogComfyTextures, Error, TEXT("Failed to decompress image"));
-        Callback(Pixels, 0, 0, false);
-        return;
-      }
-
-      int Width = ImageWrapper->GetWidth();
-      int Height = ImageWrapper->GetHeight();
-
-      Pixels.SetNumUninitialized(Width * Height);
-
-      // Copy the decompressed pixel data
-
-      const uint8* PixelData = RawData.GetData();
-
-      for (int32 PixelIndex = 0; PixelIndex < Pixels.Num(); ++PixelIndex)
-      {
-        int32 Index = PixelIndex * 4; // 4 bytes per pixel (BGRA)
-        FColor& Pixel = Pixels[PixelIndex];
-        Pixel.B = PixelData[Index];
-        Pixel.G = PixelData[Index + 1];
-        Pixel.R = PixelData[Index + 2];
-        Pixel.A = PixelData[Index + 3];
-      }
+      Async(EAsyncExecution::ThreadPool, [PngData, Callback]()
+        {
+          TArray64<uint8> Pixels;
+          int Width = 0;
+          int Height = 0;
+          bool bSuccess = DecodePngImage(PngData, Pixels, Width, Height);
 
-      Callback(Pixels, Width, Height, true);
+          AsyncTask(ENamedThreads::GameThread, [Pixels = MoveTemp(Pixels), Width, Height, bSuccess, Callback]() mutable
+            {
+              Callback(MoveTemp(Pixels), Width, Height, bSuccess);
+            });
+        });
     });
 }
 
-// calculate the approximate screen bounds of an actor using the actor bounds and the camera view info
-bool UComfyTexturesWidgetBase::CalculateApproximateScreenBounds(AActor* Actor, const FMinimalViewInfo& ViewInfo, FBox2D& OutBounds) const
+// projects the corners of the actor bounds with ViewProjectionMatrix and returns their screen bounds in [0, 1],
+// corners on or behind the camera plane project mirrored, such bounds are rejected when bRejectBehindCamera is set
+static bool ProjectActorScreenBounds(AActor* Actor, const FMatrix& ViewProjectionMatrix, bool bRejectBehindCamera, FBox2D& OutBounds)
 {
-  if (Actor == nullptr)
-  {
-    UE_LOG(LogComfyTextures, Error, TEXT("Actor is null."));
-    return false;
-  }
-
   FBox ActorBounds = Actor->GetComponentsBoundingBox(true);
   FVector ActorExtent = ActorBounds.GetExtent();
 
@@ -2131,18 +3352,16 @@ bool UComfyTexturesWidgetBase::CalculateApproximateScreenBounds(AActor* Actor, c
     Corners[CornerIndex] = ActorCenter + Corners[CornerIndex];
   }
 
-  TOptional<FMatrix> CustomProjectionMatrix;
-  FMatrix ViewMatrix;
-  FMatrix ProjectionMatrix;
-  FMatrix ViewProjectionMatrix;
-  UGameplayStatics::CalculateViewProjectionMatricesFromMinimalView(ViewInfo, CustomProjectionMatrix,
-    ViewMatrix, ProjectionMatrix, ViewProjectionMatrix);
-
   // project the corners onto the screen
   FVector2D ScreenCorners[8];
   for (int CornerIndex = 0; CornerIndex < 8; CornerIndex++)
   {
     FVector4 HomogeneousPosition = ViewProjectionMatrix.TransformFVector4(FVector4(Corners[CornerIndex], 1.0f));
+    if (bRejectBehindCamera && HomogeneousPosition.W <= 0.0f)
+    {
+      return false;
+    }
+
     ScreenCorners[CornerIndex] = FVector2D(HomogeneousPosition.X / HomogeneousPosition.W, HomogeneousPosition.Y / HomogeneousPosition.W);
   }
 
@@ -2177,6 +3396,125 @@ bool UComfyTexturesWidgetBase::CalculateApproximateScreenBounds(AActor* Actor, c
   return true;
 }
 
+// calculate the approximate screen bounds of an actor using the actor bounds and the camera view info
+bool UComfyTexturesWidgetBase::CalculateApproximateScreenBounds(AActor* Actor, const FMinimalViewInfo& ViewInfo, FBox2D& OutBounds, bool bRejectBehindCamera) const
+{
+  if (Actor == nullptr)
+  {
+    UE_LOG(LogComfyTextures, Error, TEXT("Actor is null."));
+    return false;
+  }
+
+  TOptional<FMatrix> CustomProjectionMatrix;
+  FMatrix ViewMatrix;
+  FMatrix ProjectionMatrix;
+  FMatrix ViewProjectionMatrix;
+  UGameplayStatics::CalculateViewProjectionMatricesFromMinimalView(ViewInfo, CustomProjectionMatrix,
+    ViewMatrix, ProjectionMatrix, ViewProjectionMatrix);
+
+  return ProjectActorScreenBounds(Actor, ViewProjectionMatrix, bRejectBehindCamera, OutBounds);
+}
+
+// the view resolution at which every actor visible in the view gets one output pixel per texel of its texture,
+// ViewProjectionMatrix is the one the capture was rendered with so that a crop is accounted for,
+// returns 0 when that is not below MaxSize or when the texture sizes are unknown
+int UComfyTexturesWidgetBase::CalculateRequiredOutputSize(const TArray<AActor*>& Actors, const FMatrix& ViewProjectionMatrix, int MaxSize) const
+{
+  float RequiredSize = 0.0f;
+
+  for (AActor* Actor : Actors)
+  {
+    UStaticMeshComponent* StaticMeshComponent = Actor != nullptr ? Actor->FindComponentByClass<UStaticMeshComponent>() : nullptr;
+    UMaterialInterface* Material = StaticMeshComponent != nullptr ? StaticMeshComponent->GetMaterial(0) : nullptr;
+
+    UTexture* Texture = nullptr;
+    if (Material == nullptr || !Material->GetTextureParameterValue(TEXT("BaseColor"), Texture) || Cast<UTexture2D>(Texture) == nullptr)
+    {
+      return 0;
+    }
+
+    // actors reaching behind the camera have no meaningful screen size, other actors decide the resolution
+    FBox2D ActorScreenBounds;
+    if (!ProjectActorScreenBounds(Actor, ViewProjectionMatrix, true, ActorScreenBounds))
+    {
+      continue;
+    }
+
+    // actors outside of the view do not need any resolution from it
+    FVector2D SizeOnScreen = ActorScreenBounds.GetSize();
+    float LargerSize = FMath::Max(SizeOnScreen.X, SizeOnScreen.Y);
+    if (LargerSize <= KINDA_SMALL_NUMBER)
+    {
+      continue;
+    }
+
+    UTexture2D* Texture2D = Cast<UTexture2D>(Texture);
+    int TextureSize = FMath::Max(Texture2D->GetSizeX(), Texture2D->GetSizeY());
+    RequiredSize = FMath::Max(RequiredSize, TextureSize / LargerSize);
+  }
+
+  if (RequiredSize <= 0.0f)
+  {
+    return 0;
+  }
+
+  int OutputSize = FMath::RoundUpToPowerOfTwo(FMath::CeilToInt(RequiredSize));
+  OutputSize = FMath::Max(OutputSize, 64);
+
+  return OutputSize < MaxSize ? OutputSize : 0;
+}
+
+// calculate a square region of the screen in [-1, 1] projection space that contains all actors plus a margin
+bool UComfyTexturesWidgetBase::CalculateCaptureCropBounds(const TArray<AActor*>& Actors, const FMinimalViewInfo& ViewInfo, float Margin, FBox2D& OutBounds) const
+{
+  FBox2D ScreenBounds(ForceInit);
+
+  for (AActor* Actor : Actors)
+  {
+    if (Actor == nullptr)
+    {
+      continue;
+    }
+
+    // the screen bounds are unreliable when the camera is inside the actor bounds
+    FBox ActorBounds = Actor->GetComponentsBoundingBox(true);
+    if (ViewInfo.ProjectionMode == ECameraProjectionMode::Perspective && ActorBounds.IsInsideOrOn(ViewInfo.Location))
+    {
+      return false;
+    }
+
+    // an actor that extends behind the camera would give mirrored bounds and the crop could cut it away
+    FBox2D ActorScreenBounds;
+    if (!CalculateApproximateScreenBounds(Actor, ViewInfo, ActorScreenBounds, true))
+    {
+      return false;
+    }
+
+    ScreenBounds += ActorScreenBounds;
+  }
+
+  if (!ScreenBounds.bIsValid)
+  {
+    return false;
+  }
+
+  // convert from [0, 1] back to [-1, 1]
+  FVector2D Center = ScreenBounds.GetCenter() * 2.0f - FVector2D(1.0f, 1.0f);
+  FVector2D Size = ScreenBounds.GetSize() * 2.0f;
+
+  // the capture is square so the crop has to be as well
+  float HalfSize = FMath::Max(Size.X, Size.Y) * (1.0f + Margin * 2.0f) * 0.5f;
+
+  // not worth cropping if the actors already fill the screen
+  if (HalfSize >= 0.9f || HalfSize <= KINDA_SMALL_NUMBER)
+  {
+    return false;
+  }
+
+  OutBounds = FBox2D(Center - FVector2D(HalfSize, HalfSize), Center + FVector2D(HalfSize, HalfSize));
+  return true;
+}
+
 UTexture2D* UComfyTexturesWidgetBase::CreateTexture2D(int Width, int Height, const TArray<FColor>& Pixels) const
 {
   if (Pixels.Num() != Width * Height)
@@ -2279,131 +3617,301 @@ bool UComfyTexturesWidgetBase::CreateAssetPackage(UObject* Asset, FString Packag
     return false;
   }
 
-  return true;
+  return true;
+}
+
+void UComfyTexturesWidgetBase::CreateEditMaskFromImage(const TArray<FLinearColor>& Pixels, TArray<FLinearColor>& OutPixels) const
+{
+  // every pixel that's approximately 1, 0, 1 is considered a mask pixel
+  // every other pixel is considered a non-mask pixel and is set to 0, 0, 0, 0
+
+  OutPixels.SetNum(Pixels.Num());
+
+  for (int Index = 0; Index < Pixels.Num(); Index++)
+  {
+    FLinearColor Pixel = Pixels[Index];
+    float Epsilon = 0.05f;
+
+    if (FMath::Abs(Pixel.R - 1.0f) < Epsilon && Pixel.G < Epsilon && FMath::Abs(Pixel.B - 1.0f) < Epsilon)
+    {
+      OutPixels[Index] = FLinearColor(1.0f, 1.0f, 1.0f, 1.0f);
+    }
+    else
+    {
+      OutPixels[Index] = FLinearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    }
+  }
+}
+
+void UComfyTexturesWidgetBase::CreateEditMaskFromDepth(const FComfyTexturesImageData& SceneDepth, const FComfyTexturesImageData& ObjectDepth, FComfyTexturesImageData& OutEditMask) const
+{
+  OutEditMask.Width = ObjectDepth.Width;
+  OutEditMask.Height = ObjectDepth.Height;
+  OutEditMask.Pixels.SetNum(ObjectDepth.Pixels.Num());
+
+  if (SceneDepth.Pixels.Num() != ObjectDepth.Pixels.Num())
+  {
+    UE_LOG(LogComfyTextures, Error, TEXT("Scene and object depth images have different dimensions."));
+    return;
+  }
+
+  for (int Index = 0; Index < ObjectDepth.Pixels.Num(); Index++)
+  {
+    float Depth = ObjectDepth.Pixels[Index].R;
+    float ClosestDepth = SceneDepth.Pixels[Index].R;
+
+    // pixels without any selected actor keep the far plane depth
+    bool bIsMasked = Depth < 65504.0f && Depth <= ClosestDepth * 1.001f + 1.0f;
+
+    OutEditMask.Pixels[Index] = bIsMasked ? FLinearColor(1.0f, 1.0f, 1.0f, 1.0f) : FLinearColor(0.0f, 0.0f, 0.0f, 0.0f);
+  }
+}
+
+// number of image rows processed by each parallel gradient task
+static const int GradientRowsPerTask = 16;
+
+// decode the image once into planar float channels, depth uses the red channel and normals are decoded to unit vectors
+static void DecodeGradientPlanes(const FComfyTexturesImageData& Image, bool bIsDepth, TArray<float>& OutPlanes)
+{
+  const int NumPixels = Image.Width * Image.Height;
+  OutPlanes.SetNumUninitialized(NumPixels * (bIsDepth ? 1 : 3));
+
+  float* PlaneX = OutPlanes.GetData();
+  float* PlaneY = PlaneX + NumPixels;
+  float* PlaneZ = PlaneY + NumPixels;
+
+  ParallelFor(FMath::DivideAndRoundUp(Image.Height, GradientRowsPerTask), [&](int TaskIndex)
+    {
+      int StartIndex = TaskIndex * GradientRowsPerTask * Image.Width;
+      int EndIndex = FMath::Min(StartIndex + GradientRowsPerTask * Image.Width, NumPixels);
+
+      if (bIsDepth)
+      {
+        for (int Index = StartIndex; Index < EndIndex; Index++)
+        {
+          PlaneX[Index] = Image.Pixels[Index].R;
+        }
+
+        return;
+      }
+
+      for (int Index = StartIndex; Index < EndIndex; Index++)
+      {
+        const FLinearColor& Pixel = Image.Pixels[Index];
+        FVector3f Normal(Pixel.R * 2.0f - 1.0f, Pixel.G * 2.0f - 1.0f, Pixel.B * 2.0f - 1.0f);
+        Normal = Normal.GetSafeNormal();
+
+        PlaneX[Index] = Normal.X;
+        PlaneY[Index] = Normal.Y;
+        PlaneZ[Index] = Normal.Z;
+      }
+    });
+}
+
+// sobel gradient magnitude at a single pixel of the row with clamped neighbours, used for the row borders
+static float ComputeGradientAt(const float* Smooth, const float* Diff, int NumChannels, bool bIsDepth, int Width, int X)
+{
+  int Left = FMath::Max(X - 1, 0);
+  int Right = FMath::Min(X + 1, Width - 1);
+
+  float Sum = 0.0f;
+
+  for (int Channel = 0; Channel < NumChannels; Channel++)
+  {
+    const float* S = Smooth + Channel * Width;
+    const float* D = Diff + Channel * Width;
+
+    float GradX = S[Right] - S[Left];
+    float GradY = D[Left] + 2.0f * D[X] + D[Right];
+
+    // depth uses the euclidean magnitude, normals the magnitude of the summed directions
+    Sum += bIsDepth ? GradX * GradX + GradY * GradY : (GradX + GradY) * (GradX + GradY);
+  }
+
+  return FMath::Sqrt(Sum);
 }
 
-void UComfyTexturesWidgetBase::CreateEditMaskFromImage(const TArray<FLinearColor>& Pixels, TArray<FLinearColor>& OutPixels) const
+// separable 3x3 sobel over one row, the vertical pass smooths and differences the three input rows
+// and the horizontal pass finishes both kernels four pixels at a time
+static void ComputeGradientRow(const float* const* Above, const float* const* Center, const float* const* Below, int NumChannels, bool bIsDepth,
+  int Width, float* Smooth, float* Diff, float* OutGrad, float& OutMax, float& OutSum)
 {
-  // every pixel that's approximately 1, 0, 1 is considered a mask pixel
-  // every other pixel is considered a non-mask pixel and is set to 0, 0, 0, 0
-
-  OutPixels.SetNum(Pixels.Num());
-
-  for (int Index = 0; Index < Pixels.Num(); Index++)
+  for (int Channel = 0; Channel < NumChannels; Channel++)
   {
-    FLinearColor Pixel = Pixels[Index];
-    float Epsilon = 0.05f;
-
-    if (FMath::Abs(Pixel.R - 1.0f) < Epsilon && Pixel.G < Epsilon && FMath::Abs(Pixel.B - 1.0f) < Epsilon)
+    const float* A = Above[Channel];
+    const float* C = Center[Channel];
+    const float* B = Below[Channel];
+    float* S = Smooth + Channel * Width;
+    float* D = Diff + Channel * Width;
+
+    int X = 0;
+    for (; X + 4 <= Width; X += 4)
     {
-      OutPixels[Index] = FLinearColor(1.0f, 1.0f, 1.0f, 1.0f);
+      VectorRegister4Float VA = VectorLoad(A + X);
+      VectorRegister4Float VC = VectorLoad(C + X);
+      VectorRegister4Float VB = VectorLoad(B + X);
+
+      VectorStore(VectorAdd(VectorAdd(VA, VB), VectorAdd(VC, VC)), S + X);
+      VectorStore(VectorSubtract(VB, VA), D + X);
     }
-    else
+
+    for (; X < Width; X++)
     {
-      OutPixels[Index] = FLinearColor(0.0f, 0.0f, 0.0f, 0.0f);
+      S[X] = A[X] + 2.0f * C[X] + B[X];
+      D[X] = B[X] - A[X];
     }
   }
-}
 
-// Sobel operator kernels for x and y directions
-static const int SobelX[3][3] = { {-1, 0, 1}, {-2, 0, 2}, {-1, 0, 1} };
-static const int SobelY[3][3] = { {-1, -2, -1}, {0, 0, 0}, {1, 2, 1} };
+  float Max = 0.0f;
+  float Sum = 0.0f;
 
-static float ComputeDepthGradient(const FComfyTexturesImageData& Image, int X, int Y)
-{
-  float GradX = 0.0f;
-  float GradY = 0.0f;
+  VectorRegister4Float MaxVec = VectorZeroFloat();
+  VectorRegister4Float SumVec = VectorZeroFloat();
 
-  // Apply the Sobel operator
-  for (int I = -1; I <= 1; I++)
+  int X = 1;
+  for (; X + 4 <= Width - 1; X += 4)
   {
-    for (int J = -1; J <= 1; J++)
+    VectorRegister4Float Magnitude = VectorZeroFloat();
+
+    for (int Channel = 0; Channel < NumChannels; Channel++)
     {
-      int PixelX = FMath::Clamp(X + I, 0, Image.Width - 1);
-      int PixelY = FMath::Clamp(Y + J, 0, Image.Height - 1);
+      const float* S = Smooth + Channel * Width;
+      const float* D = Diff + Channel * Width;
 
-      float Value = Image.Pixels[PixelY * Image.Width + PixelX].R; // Assuming depth is stored in the red channel
+      VectorRegister4Float GradX = VectorSubtract(VectorLoad(S + X + 1), VectorLoad(S + X - 1));
+      VectorRegister4Float DC = VectorLoad(D + X);
+      VectorRegister4Float GradY = VectorAdd(VectorAdd(VectorLoad(D + X - 1), VectorLoad(D + X + 1)), VectorAdd(DC, DC));
 
-      GradX += Value * SobelX[I + 1][J + 1];
-      GradY += Value * SobelY[I + 1][J + 1];
+      if (bIsDepth)
+      {
+        Magnitude = VectorMultiplyAdd(GradX, GradX, Magnitude);
+        Magnitude = VectorMultiplyAdd(GradY, GradY, Magnitude);
+      }
+      else
+      {
+        VectorRegister4Float Grad = VectorAdd(GradX, GradY);
+        Magnitude = VectorMultiplyAdd(Grad, Grad, Magnitude);
+      }
     }
+
+    Magnitude = VectorSqrt(Magnitude);
+    VectorStore(Magnitude, OutGrad + X);
+
+    MaxVec = VectorMax(MaxVec, Magnitude);
+    SumVec = VectorAdd(SumVec, Magnitude);
   }
 
-  return FMath::Sqrt(GradX * GradX + GradY * GradY);
-}
+  alignas(16) float Lanes[4];
 
-static float ComputeNormalsGradient(const FComfyTexturesImageData& Image, int X, int Y)
-{
-  FVector GradX(0.0f, 0.0f, 0.0f);
-  FVector GradY(0.0f, 0.0f, 0.0f);
+  VectorStoreAligned(MaxVec, Lanes);
+  Max = FMath::Max(FMath::Max(Lanes[0], Lanes[1]), FMath::Max(Lanes[2], Lanes[3]));
 
-  // Apply the Sobel operator
-  for (int I = -1; I <= 1; I++)
-  {
-    for (int J = -1; J <= 1; J++)
+  VectorStoreAligned(SumVec, Lanes);
+  Sum = Lanes[0] + Lanes[1] + Lanes[2] + Lanes[3];
+
+  // the remaining pixels and the borders are handled out of line
+  auto ComputeScalar = [&](int PixelX)
     {
-      int PixelX = FMath::Clamp(X + I, 0, Image.Width - 1);
-      int PixelY = FMath::Clamp(Y + J, 0, Image.Height - 1);
+      float Gradient = ComputeGradientAt(Smooth, Diff, NumChannels, bIsDepth, Width, PixelX);
+      OutGrad[PixelX] = Gradient;
+      Max = FMath::Max(Max, Gradient);
+      Sum += Gradient;
+    };
 
-      FVector Normal = FVector
-      (
-        Image.Pixels[PixelY * Image.Width + PixelX].R,
-        Image.Pixels[PixelY * Image.Width + PixelX].G,
-        Image.Pixels[PixelY * Image.Width + PixelX].B
-      );
+  for (; X < Width - 1; X++)
+  {
+    ComputeScalar(X);
+  }
 
-      Normal -= FVector(0.5f, 0.5f, 0.5f);
-      Normal *= 2.0f;
-      Normal = Normal.GetSafeNormal();
+  ComputeScalar(0);
 
-      GradX += Normal * SobelX[I + 1][J + 1];
-      GradY += Normal * SobelY[I + 1][J + 1];
-    }
+  if (Width > 1)
+  {
+    ComputeScalar(Width - 1);
   }
 
-  // Calculate the gradient magnitude
-  FVector Gradient = GradX + GradY;
-  return Gradient.Size();
+  OutMax = Max;
+  OutSum = Sum;
 }
 
-static float ComputeImageGradient(const FComfyTexturesImageData& Image, bool bIsDepth, TArray<float>& OutGrad)
+// computes the unnormalized gradient magnitudes and the maximum of every band of GradientRowsPerTask rows,
+// returns the average of the normalized magnitudes
+static float ComputeImageGradient(const FComfyTexturesImageData& Image, bool bIsDepth, TArray<float>& OutGrad, TArray<float>& OutTileMax, float& OutMaxGradient)
 {
-  OutGrad.SetNumUninitialized(Image.Pixels.Num());
+  const int Width = Image.Width;
+  const int Height = Image.Height;
+  const int NumChannels = bIsDepth ? 1 : 3;
 
-  float MaxGradient = -FLT_MAX;
+  OutGrad.SetNumUninitialized(Image.Pixels.Num());
+  OutTileMax.Reset();
+  OutMaxGradient = 0.0f;
 
-  for (int Y = 0; Y < Image.Height; Y++)
+  if (Width <= 0 || Height <= 0)
   {
-    for (int X = 0; X < Image.Width; X++)
+    return 0.0f;
+  }
+
+  TArray<float> Planes;
+  DecodeGradientPlanes(Image, bIsDepth, Planes);
+
+  const int NumTasks = FMath::DivideAndRoundUp(Height, GradientRowsPerTask);
+
+  TArray<float>& TaskMax = OutTileMax;
+  TaskMax.SetNumZeroed(NumTasks);
+
+  TArray<double> TaskSum;
+  TaskSum.SetNumZeroed(NumTasks);
+
+  ParallelFor(NumTasks, [&](int TaskIndex)
     {
-      float Gradient = bIsDepth ? ComputeDepthGradient(Image, X, Y) : ComputeNormalsGradient(Image, X, Y);
-      OutGrad[Y * Image.Width + X] = Gradient;
+      // vertical pass results for every channel
+      TArray<float> Scratch;
+      Scratch.SetNumUninitialized(2 * NumChannels * Width);
 
-      MaxGradient = FMath::Max(MaxGradient, Gradient);
-    }
-  }
+      float* Smooth = Scratch.GetData();
+      float* Diff = Scratch.GetData() + NumChannels * Width;
 
-  if (FMath::IsNearlyZero(MaxGradient))
+      int StartY = TaskIndex * GradientRowsPerTask;
+      int EndY = FMath::Min(StartY + GradientRowsPerTask, Height);
+
+      for (int Y = StartY; Y < EndY; Y++)
+      {
+        const float* Rows[3][3];
+        for (int Channel = 0; Channel < NumChannels; Channel++)
+        {
+          const float* Plane = Planes.GetData() + Channel * Width * Height;
+          Rows[0][Channel] = Plane + FMath::Max(Y - 1, 0) * Width;
+          Rows[1][Channel] = Plane + Y * Width;
+          Rows[2][Channel] = Plane + FMath::Min(Y + 1, Height - 1) * Width;
+        }
+
+        float RowMax = 0.0f;
+        float RowSum = 0.0f;
+        ComputeGradientRow(Rows[0], Rows[1], Rows[2], NumChannels, bIsDepth, Width, Smooth, Diff, OutGrad.GetData() + Y * Width, RowMax, RowSum);
+
+        TaskMax[TaskIndex] = FMath::Max(TaskMax[TaskIndex], RowMax);
+        TaskSum[TaskIndex] += RowSum;
+      }
+    });
+
+  double Sum = 0.0;
+
+  for (int TaskIndex = 0; TaskIndex < NumTasks; TaskIndex++)
   {
-    return 0.0f;
+    OutMaxGradient = FMath::Max(OutMaxGradient, TaskMax[TaskIndex]);
+    Sum += TaskSum[TaskIndex];
   }
 
-  float AverageMagnitude = 0.0f;
-
-  for (int Y = 0; Y < Image.Height; Y++)
+  if (FMath::IsNearlyZero(OutMaxGradient))
   {
-    for (int X = 0; X < Image.Width; X++)
-    {
-      OutGrad[Y * Image.Width + X] /= MaxGradient;
-      AverageMagnitude += OutGrad[Y * Image.Width + X];
-    }
+    return 0.0f;
   }
 
-  AverageMagnitude /= Image.Pixels.Num();
-  return AverageMagnitude;
+  // normalizing by the maximum is deferred to the thresholding pass
+  return (float)(Sum / OutMaxGradient / Image.Pixels.Num());
 }
 
-static float ComputeAdaptiveThreshold(const TArray<float>& Grad, float AverageGradient, float BaseThreshold, float ScaleFactor = 1.0f)
+static float ComputeAdaptiveThreshold(float AverageGradient, float BaseThreshold, float ScaleFactor = 1.0f)
 {
   return BaseThreshold + ScaleFactor * AverageGradient;
 }
@@ -2422,40 +3930,93 @@ void UComfyTexturesWidgetBase::CreateEdgeMask(const FComfyTexturesImageData& Dep
   OutEdgeMask.Pixels.SetNumUninitialized(Depth.Pixels.Num());
 
   TArray<float> DepthGrad;
-  float AvgDepth = ComputeImageGradient(Depth, true, DepthGrad);
+  TArray<float> DepthTileMax;
+  float MaxDepth = 0.0f;
+  float AvgDepth = ComputeImageGradient(Depth, true, DepthGrad, DepthTileMax, MaxDepth);
 
   TArray<float> NormalsGrad;
-  float AvgNormals = ComputeImageGradient(Normals, false, NormalsGrad);
+  TArray<float> NormalsTileMax;
+  float MaxNormals = 0.0f;
+  float AvgNormals = ComputeImageGradient(Normals, false, NormalsGrad, NormalsTileMax, MaxNormals);
+
+  // gradients are normalized by their maximum unless the image is flat
+  float DepthNormalize = FMath::IsNearlyZero(MaxDepth) ? 1.0f : 1.0f / MaxDepth;
+  float NormalsNormalize = FMath::IsNearlyZero(MaxNormals) ? 1.0f : 1.0f / MaxNormals;
 
   const float DepthBaseThreshold = 0.01f;
   const float NormalsBaseThreshold = 0.1f;
   const float DepthScale = 8.0f;
   const float NormalsScale = 0.8f;
 
-  float DepthThreshold = ComputeAdaptiveThreshold(DepthGrad, AvgDepth, DepthBaseThreshold);
-  float NormalsThreshold = ComputeAdaptiveThreshold(NormalsGrad, AvgNormals, NormalsBaseThreshold);
+  float DepthThreshold = ComputeAdaptiveThreshold(AvgDepth, DepthBaseThreshold);
+  float NormalsThreshold = ComputeAdaptiveThreshold(AvgNormals, NormalsBaseThreshold);
 
-  // Assuming Depth and Normals are of the same dimensions
-  for (int Y = 0; Y < Depth.Height; Y++)
-  {
-    for (int X = 0; X < Depth.Width; X++)
+  const int Width = Depth.Width;
+  const int NumTasks = DepthTileMax.Num();
+
+  // threshold and combine both gradients in one pass over the same row bands the gradients were computed in,
+  // a band whose maximum is below the threshold contributes nothing and is not read
+  ParallelFor(NumTasks, [&](int TaskIndex)
     {
-      // Compute gradients
-      float DepthGradient = DepthGrad[Y * Depth.Width + X];
-      float NormalsGradient = NormalsGrad[Y * Depth.Width + X];
+      const bool bDepthEdges = DepthTileMax[TaskIndex] * DepthNormalize >= DepthThreshold;
+      const bool bNormalsEdges = NormalsTileMax[TaskIndex] * NormalsNormalize >= NormalsThreshold;
 
-      // Apply thresholds
-      DepthGradient = (DepthGradient >= DepthThreshold) ? DepthGradient : 0.0f;
-      NormalsGradient = (NormalsGradient >= NormalsThreshold) ? NormalsGradient : 0.0f;
+      int StartIndex = TaskIndex * GradientRowsPerTask * Width;
+      int EndIndex = FMath::Min(StartIndex + GradientRowsPerTask * Width, Depth.Pixels.Num());
 
-      // Combine gradients for edge strength
-      float EdgeStrength = FMath::Max(DepthGradient * DepthScale, NormalsGradient * NormalsScale);
-      EdgeStrength = FMath::Clamp(EdgeStrength, 0.0f, 1.0f);
+      FLinearColor* OutPixels = OutEdgeMask.Pixels.GetData();
 
-      // Set the pixel value in the output mask
-      OutEdgeMask.Pixels[Y * Depth.Width + X] = FLinearColor(EdgeStrength, EdgeStrength, EdgeStrength, 1.0f);
-    }
-  }
+      if (!bDepthEdges && !bNormalsEdges)
+      {
+        for (int Index = StartIndex; Index < EndIndex; Index++)
+        {
+          OutPixels[Index] = FLinearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        }
+
+        return;
+      }
+
+      const VectorRegister4Float Zero = VectorZeroFloat();
+      const VectorRegister4Float One = VectorSetFloat1(1.0f);
+      const VectorRegister4Float DepthMul = VectorSetFloat1(bDepthEdges ? DepthNormalize : 0.0f);
+      const VectorRegister4Float NormalsMul = VectorSetFloat1(bNormalsEdges ? NormalsNormalize : 0.0f);
+      const VectorRegister4Float DepthThresholdVec = VectorSetFloat1(DepthThreshold);
+      const VectorRegister4Float NormalsThresholdVec = VectorSetFloat1(NormalsThreshold);
+      const VectorRegister4Float DepthScaleVec = VectorSetFloat1(DepthScale);
+      const VectorRegister4Float NormalsScaleVec = VectorSetFloat1(NormalsScale);
+
+      alignas(16) float Strength[4];
+
+      int Index = StartIndex;
+      for (; Index + 4 <= EndIndex; Index += 4)
+      {
+        VectorRegister4Float DepthGradient = VectorMultiply(VectorLoad(DepthGrad.GetData() + Index), DepthMul);
+        VectorRegister4Float NormalsGradient = VectorMultiply(VectorLoad(NormalsGrad.GetData() + Index), NormalsMul);
+
+        DepthGradient = VectorSelect(VectorCompareGE(DepthGradient, DepthThresholdVec), DepthGradient, Zero);
+        NormalsGradient = VectorSelect(VectorCompareGE(NormalsGradient, NormalsThresholdVec), NormalsGradient, Zero);
+
+        VectorRegister4Float EdgeStrength = VectorMax(VectorMultiply(DepthGradient, DepthScaleVec), VectorMultiply(NormalsGradient, NormalsScaleVec));
+        VectorStoreAligned(VectorMin(VectorMax(EdgeStrength, Zero), One), Strength);
+
+        for (int Lane = 0; Lane < 4; Lane++)
+        {
+          OutPixels[Index + Lane] = FLinearColor(Strength[Lane], Strength[Lane], Strength[Lane], 1.0f);
+        }
+      }
+
+      for (; Index < EndIndex; Index++)
+      {
+        float DepthGradient = bDepthEdges ? DepthGrad[Index] * DepthNormalize : 0.0f;
+        float NormalsGradient = bNormalsEdges ? NormalsGrad[Index] * NormalsNormalize : 0.0f;
+
+        DepthGradient = (DepthGradient >= DepthThreshold) ? DepthGradient : 0.0f;
+        NormalsGradient = (NormalsGradient >= NormalsThreshold) ? NormalsGradient : 0.0f;
+
+        float EdgeStrength = FMath::Clamp(FMath::Max(DepthGradient * DepthScale, NormalsGradient * NormalsScale), 0.0f, 1.0f);
+        OutPixels[Index] = FLinearColor(EdgeStrength, EdgeStrength, EdgeStrength, 1.0f);
+      }
+    });
 }
 
 void UComfyTexturesWidgetBase::LoadRenderResultImages(TFunction<void(bool)> Callback)
@@ -2474,42 +4035,40 @@ void UComfyTexturesWidgetBase::LoadRenderResultImages(TFunction<void(bool)> Call
     int Index = Pair.Key;
     FComfyTexturesRenderDataPtr RenderData = Pair.Value;
 
-    Async(EAsyncExecution::ThreadPool, [this, StateData, RenderData, Callback]()
+    // requests are issued on the game thread, their completion callbacks and the task counter stay there
+    FString FileName = RenderData->OutputFileNames[0];
+    bool bSuccess = DownloadImage(FileName, [this, FileName, StateData, RenderData, Callback](TArray64<uint8> Pixels, int Width, int Height, bool bWasSuccessful)
       {
-        FString FileName = RenderData->OutputFileNames[0];
-        bool bSuccess = DownloadImage(FileName, [this, FileName, StateData, RenderData, Callback](TArray<FColor> Pixels, int Width, int Height, bool bWasSuccessful)
-          {
-            if (!bWasSuccessful)
-            {
-              UE_LOG(LogComfyTextures, Error, TEXT("Failed to download image %s"), *FileName);
-              StateData->bAllSuccessful = false;
-            }
-            else
-            {
-              RenderData->OutputPixels = Pixels;
-              RenderData->OutputWidth = Width;
-              RenderData->OutputHeight = Height;
-            }
-
-            // Check if this is the last task
-            if (--StateData->RemainingTasks == 0)
-            {
-              Callback(StateData->bAllSuccessful);
-            }
-          });
-
-        if (!bSuccess)
+        if (!bWasSuccessful)
         {
           UE_LOG(LogComfyTextures, Error, TEXT("Failed to download image %s"), *FileName);
           StateData->bAllSuccessful = false;
+        }
+        else
+        {
+          RenderData->OutputPixels = MoveTemp(Pixels);
+          RenderData->OutputWidth = Width;
+          RenderData->OutputHeight = Height;
+        }
 
-          // Check if this is the last task
-          if (--StateData->RemainingTasks == 0)
-          {
-            Callback(StateData->bAllSuccessful);
-          }
+        // Check if this is the last task
+        if (--StateData->RemainingTasks == 0)
+        {
+          Callback(StateData->bAllSuccessful);
         }
       });
+
+    if (!bSuccess)
+    {
+      UE_LOG(LogComfyTextures, Error, TEXT("Failed to download image %s"), *FileName);
+      StateData->bAllSuccessful = false;
+
+      // Check if this is the last task
+      if (--StateData->RemainingTasks == 0)
+      {
+        Callback(StateData->bAllSuccessful);
+      }
+    }
   }
 }
 
@@ -2518,14 +4077,15 @@ void UComfyTexturesWidgetBase::TransitionToIdleState()
   RenderQueue.Empty();
   PromptIdToRequestIndex.Empty();
   ActorSet.Empty();
+  NumPendingUploads = 0;
 
   State = EComfyTexturesState::Idle;
   OnStateChanged(State);
 }
 
-bool UComfyTexturesWidgetBase::CreateCameraTransforms(AActor* Actor, const FComfyTexturesRenderOptions& RenderOpts, TArray<FMinimalViewInfo>& OutViewInfos) const
+bool UComfyTexturesWidgetBase::CreateCameraTransforms(const TArray<AActor*>& Actors, const FComfyTexturesRenderOptions& RenderOpts, TArray<FMinimalViewInfo>& OutViewInfos) const
 {
-  if (Actor == nullptr)
+  if (Actors.Num() == 0 || Actors[0] == nullptr)
   {
     UE_LOG(LogComfyTextures, Error, TEXT("Actor is null."));
     return false;
@@ -2535,52 +4095,85 @@ bool UComfyTexturesWidgetBase::CreateCameraTransforms(AActor* Actor, const FComf
 
   if (RenderOpts.CameraMode == EComfyTexturesCameraMode::EditorCamera)
   {
-    // get current editor viewport camera transform
-    FEditorViewportClient* EditorViewportClient = (FEditorViewportClient*)GEditor->GetActiveViewport()->GetClient();
-
-    // get the camera transform
-    const FViewportCameraTransform& CameraTransform = EditorViewportClient->GetViewTransform();
-
-    // create a minimal view info from the camera transform
     FMinimalViewInfo ViewInfo;
-    ViewInfo.Location = CameraTransform.GetLocation();
-    ViewInfo.Rotation = CameraTransform.GetRotation();
-    ViewInfo.FOV = EditorViewportClient->ViewFOV;
-    ViewInfo.OrthoWidth = EditorViewportClient->GetOrthoUnitsPerPixel(EditorViewportClient->Viewport) * EditorViewportClient->Viewport->GetSizeXY().X;
-    ViewInfo.ProjectionMode = EditorViewportClient->IsOrtho() ? ECameraProjectionMode::Orthographic : ECameraProjectionMode::Perspective;
-    ViewInfo.AspectRatio = 1.0f; // EditorViewportClient->AspectRatio;
-    ViewInfo.OrthoNearClipPlane = EditorViewportClient->GetNearClipPlane();
-    ViewInfo.PerspectiveNearClipPlane = EditorViewportClient->GetNearClipPlane();
-
+    CreateEditorCameraViewInfo(ViewInfo);
     OutViewInfos.Add(ViewInfo);
   }
   else if (RenderOpts.CameraMode == EComfyTexturesCameraMode::ExistingCamera)
   {
-    if (RenderOpts.ExistingCamera == nullptr)
+    FMinimalViewInfo ViewInfo;
+    if (!CreateCameraViewInfo(RenderOpts.ExistingCamera, ViewInfo))
     {
-      UE_LOG(LogComfyTextures, Error, TEXT("Existing camera is null."));
       return false;
     }
 
-    // get camera component from camera actor
+    OutViewInfos.Add(ViewInfo);
+  }
+  else if (RenderOpts.CameraMode == EComfyTexturesCameraMode::MultipleCameras)
+  {
+    for (ACameraActor* Camera : RenderOpts.ExistingCameras)
+    {
+      FMinimalViewInfo ViewInfo;
+      if (!CreateCameraViewInfo(Camera, ViewInfo))
+      {
+        return false;
+      }
+
+      OutViewInfos.Add(ViewInfo);
+    }
+  }
+  else if (RenderOpts.CameraMode == EComfyTexturesCameraMode::OrbitCameras || RenderOpts.CameraMode == EComfyTexturesCameraMode::CubeCameras)
+  {
+    // frame the combined bounds of all actors
+    FBox Bounds(ForceInit);
+    for (AActor* Actor : Actors)
+    {
+      if (Actor != nullptr)
+      {
+        Bounds += Actor->GetComponentsBoundingBox(true);
+      }
+    }
 
-    UCameraComponent* CameraComponent = RenderOpts.ExistingCamera->FindComponentByClass<UCameraComponent>();
-    if (CameraComponent == nullptr)
+    if (!Bounds.IsValid)
     {
-      UE_LOG(LogComfyTextures, Error, TEXT("Camera component not found."));
+      UE_LOG(LogComfyTextures, Error, TEXT("Actors have no valid bounds."));
       return false;
     }
 
-    FMinimalViewInfo ViewInfo;
-    CameraComponent->GetCameraView(0.0f, ViewInfo);
+    TArray<FRotator> Rotations;
+
+    if (RenderOpts.CameraMode == EComfyTexturesCameraMode::OrbitCameras)
+    {
+      int NumRings = FMath::Max(RenderOpts.OrbitRingCount, 1);
+      int NumViewsPerRing = FMath::Max(RenderOpts.OrbitViewsPerRing, 1);
+
+      for (int Ring = 0; Ring < NumRings; Ring++)
+      {
+        // a single ring looks down at the actors, multiple rings are spread from above to below
+        float Pitch = -RenderOpts.OrbitPitch;
+        if (NumRings > 1)
+        {
+          Pitch = FMath::Lerp(-RenderOpts.OrbitPitch, RenderOpts.OrbitPitch, (float)Ring / (float)(NumRings - 1));
+        }
 
-    if (!FMath::IsNearlyEqual(ViewInfo.AspectRatio, 1.0f))
+        for (int View = 0; View < NumViewsPerRing; View++)
+        {
+          float Yaw = 360.0f * (float)View / (float)NumViewsPerRing;
+          Rotations.Add(FRotator(Pitch, Yaw, 0.0f));
+        }
+      }
+    }
+    else
     {
-      UE_LOG(LogComfyTextures, Warning, TEXT("Camera aspect ratio is not 1.0, overriding it."));
-      ViewInfo.AspectRatio = 1.0f;
+      Rotations.Add(FRotator(0.0f, 0.0f, 0.0f));
+      Rotations.Add(FRotator(0.0f, 90.0f, 0.0f));
+      Rotations.Add(FRotator(0.0f, 180.0f, 0.0f));
+      Rotations.Add(FRotator(0.0f, 270.0f, 0.0f));
+      Rotations.Add(FRotator(-90.0f, 0.0f, 0.0f));
+      Rotations.Add(FRotator(90.0f, 0.0f, 0.0f));
     }
 
-    OutViewInfos.Add(ViewInfo);
+    CreateRigViewInfos(Bounds, Rotations, OutViewInfos);
   }
   else
   {
@@ -2588,6 +4181,12 @@ bool UComfyTexturesWidgetBase::CreateCameraTransforms(AActor* Actor, const FComf
     return false;
   }
 
+  if (OutViewInfos.Num() == 0)
+  {
+    UE_LOG(LogComfyTextures, Error, TEXT("No camera views were created."));
+    return false;
+  }
+
   for (int Index = 0; Index < OutViewInfos.Num(); Index++)
   {
     FMinimalViewInfo& ViewInfo = OutViewInfos[Index];
@@ -2597,7 +4196,82 @@ bool UComfyTexturesWidgetBase::CreateCameraTransforms(AActor* Actor, const FComf
   return true;
 }
 
-bool UComfyTexturesWidgetBase::CaptureSceneTextures(UWorld* World, TArray<AActor*> Actors, const TArray<FMinimalViewInfo>& ViewInfos, EComfyTexturesMode Mode, const TSharedPtr<TArray<FComfyTexturesCaptureOutput>>& Outputs) const
+bool UComfyTexturesWidgetBase::CreateCameraViewInfo(ACameraActor* Camera, FMinimalViewInfo& OutViewInfo) const
+{
+  if (Camera == nullptr)
+  {
+    UE_LOG(LogComfyTextures, Error, TEXT("Existing camera is null."));
+    return false;
+  }
+
+  // get camera component from camera actor
+
+  UCameraComponent* CameraComponent = Camera->FindComponentByClass<UCameraComponent>();
+  if (CameraComponent == nullptr)
+  {
+    UE_LOG(LogComfyTextures, Error, TEXT("Camera component not found."));
+    return false;
+  }
+
+  CameraComponent->GetCameraView(0.0f, OutViewInfo);
+
+  if (!FMath::IsNearlyEqual(OutViewInfo.AspectRatio, 1.0f))
+  {
+    UE_LOG(LogComfyTextures, Warning, TEXT("Camera aspect ratio is not 1.0, overriding it."));
+    OutViewInfo.AspectRatio = 1.0f;
+  }
+
+  return true;
+}
+
+void UComfyTexturesWidgetBase::CreateEditorCameraViewInfo(FMinimalViewInfo& OutViewInfo) const
+{
+  // get current editor viewport camera transform
+  FEditorViewportClient* EditorViewportClient = (FEditorViewportClient*)GEditor->GetActiveViewport()->GetClient();
+
+  // get the camera transform
+  const FViewportCameraTransform& CameraTransform = EditorViewportClient->GetViewTransform();
+
+  // create a minimal view info from the camera transform
+  OutViewInfo.Location = CameraTransform.GetLocation();
+  OutViewInfo.Rotation = CameraTransform.GetRotation();
+  OutViewInfo.FOV = EditorViewportClient->ViewFOV;
+  OutViewInfo.OrthoWidth = EditorViewportClient->GetOrthoUnitsPerPixel(EditorViewportClient->Viewport) * EditorViewportClient->Viewport->GetSizeXY().X;
+  OutViewInfo.ProjectionMode = EditorViewportClient->IsOrtho() ? ECameraProjectionMode::Orthographic : ECameraProjectionMode::Perspective;
+  OutViewInfo.AspectRatio = 1.0f; // EditorViewportClient->AspectRatio;
+  OutViewInfo.OrthoNearClipPlane = EditorViewportClient->GetNearClipPlane();
+  OutViewInfo.PerspectiveNearClipPlane = EditorViewportClient->GetNearClipPlane();
+}
+
+void UComfyTexturesWidgetBase::CreateRigViewInfos(const FBox& Bounds, const TArray<FRotator>& Rotations, TArray<FMinimalViewInfo>& OutViewInfos) const
+{
+  // rig cameras use the projection settings of the editor camera
+  FMinimalViewInfo BaseViewInfo;
+  CreateEditorCameraViewInfo(BaseViewInfo);
+
+  FVector Center = Bounds.GetCenter();
+  float Radius = FMath::Max(Bounds.GetExtent().Size(), 1.0f);
+
+  // distance at which the bounding sphere fits into the field of view
+  float HalfFov = FMath::DegreesToRadians(FMath::Clamp(BaseViewInfo.FOV, 1.0f, 170.0f) * 0.5f);
+  float Distance = Radius / FMath::Sin(HalfFov);
+
+  for (const FRotator& Rotation : Rotations)
+  {
+    FMinimalViewInfo ViewInfo = BaseViewInfo;
+    ViewInfo.Rotation = Rotation;
+    ViewInfo.Location = Center - Rotation.Vector() * Distance;
+
+    if (ViewInfo.ProjectionMode == ECameraProjectionMode::Orthographic)
+    {
+      ViewInfo.OrthoWidth = Radius * 2.0f;
+    }
+
+    OutViewInfos.Add(ViewInfo);
+  }
+}
+
+bool UComfyTexturesWidgetBase::CaptureSceneTextures(UWorld* World, TArray<AActor*> Actors, const TArray<FMinimalViewInfo>& ViewInfos, EComfyTexturesMode Mode, EComfyTexturesEditMaskMode EditMaskMode, const TSharedPtr<TArray<FComfyTexturesCaptureOutput>>& Outputs) const
 {
   if (World == nullptr)
   {
@@ -2625,9 +4299,23 @@ bool UComfyTexturesWidgetBase::CaptureSceneTextures(UWorld* World, TArray<AActor
 
   UComfyTexturesSettings* Settings = GetMutableDefault<UComfyTexturesSettings>();
 
+  int RenderTargetSize = Settings->CaptureSize;
+  int Downsample = 1;
+
+  // render directly at the upload size and downsample while reading the pixels back
+  if (Settings->bCaptureAtUploadSize)
+  {
+    Downsample = FMath::Clamp(Settings->CaptureSupersampleFactor, 1, 4);
+    RenderTargetSize = FMath::RoundUpToPowerOfTwo(Settings->UploadSize) * Downsample;
+  }
+
+  int RawDepthDownsample = Settings->bFullResolutionBakeDepth ? 1 : Downsample;
+
+  bool bCaptureObjectMask = Mode == EComfyTexturesMode::Edit && EditMaskMode == EComfyTexturesEditMaskMode::FromObject;
+
   // create RTF RGBA8 render target
   UTextureRenderTarget2D* RenderTarget = NewObject<UTextureRenderTarget2D>();
-  RenderTarget->InitCustomFormat(Settings->CaptureSize, Settings->CaptureSize, EPixelFormat::PF_FloatRGBA, true);
+  RenderTarget->InitCustomFormat(RenderTargetSize, RenderTargetSize, EPixelFormat::PF_FloatRGBA, true);
   RenderTarget->UpdateResourceImmediate();
 
   // create scene capture component
@@ -2657,26 +4345,76 @@ bool UComfyTexturesWidgetBase::CaptureSceneTextures(UWorld* World, TArray<AActor
 
     FComfyTexturesCaptureOutput Output;
 
+    TOptional<FMatrix> CustomProjectionMatrix;
+    FMatrix ViewProjectionMatrix;
+    UGameplayStatics::CalculateViewProjectionMatricesFromMinimalView(ViewInfo, CustomProjectionMatrix,
+      Output.ViewMatrix, Output.ProjectionMatrix, ViewProjectionMatrix);
+
+    FBox2D CropBounds;
+    if (Settings->bCropCaptureToActors && CalculateCaptureCropBounds(Actors, ViewInfo, Settings->CaptureCropMargin, CropBounds))
+    {
+      FVector2D CropCenter = CropBounds.GetCenter();
+      FVector2D CropExtent = CropBounds.GetExtent();
+
+      // off-axis projection that maps the crop rectangle to the full render target
+      FMatrix CropMatrix
+      (
+        FPlane(1.0f / CropExtent.X, 0.0f, 0.0f, 0.0f),
+        FPlane(0.0f, 1.0f / CropExtent.Y, 0.0f, 0.0f),
+        FPlane(0.0f, 0.0f, 1.0f, 0.0f),
+        FPlane(-CropCenter.X / CropExtent.X, -CropCenter.Y / CropExtent.Y, 0.0f, 1.0f)
+      );
+
+      Output.ProjectionMatrix = Output.ProjectionMatrix * CropMatrix;
+
+      SceneCapture->bUseCustomProjectionMatrix = true;
+      SceneCapture->CustomProjectionMatrix = Output.ProjectionMatrix;
+
+      UE_LOG(LogComfyTextures, Verbose, TEXT("Cropping capture %d to %s"), Index, *CropBounds.ToString());
+    }
+    else
+    {
+      SceneCapture->bUseCustomProjectionMatrix = false;
+    }
+
     // capture the scene
     SceneCapture->CaptureSource = ESceneCaptureSource::SCS_SceneColorSceneDepth;
     SceneCapture->CaptureScene();
 
-    if (!ReadRenderTargetPixels(RenderTarget, EComfyTexturesRenderTextureMode::Depth, Output.Depth))
+    if (!ReadRenderTargetPixels(RenderTarget, EComfyTexturesRenderTextureMode::Depth, Downsample, Output.Depth))
     {
       UE_LOG(LogComfyTextures, Error, TEXT("Failed to read render target pixels."));
       return false;
     }
 
-    if (!ReadRenderTargetPixels(RenderTarget, EComfyTexturesRenderTextureMode::RawDepth, Output.RawDepth))
+    if (!ReadRenderTargetPixels(RenderTarget, EComfyTexturesRenderTextureMode::RawDepth, RawDepthDownsample, Output.RawDepth))
     {
       UE_LOG(LogComfyTextures, Error, TEXT("Failed to read render target pixels."));
       return false;
     }
 
+    if (bCaptureObjectMask)
+    {
+      // render the depth of only the selected actors, they are masked wherever they are the closest surface
+      SceneCapture->PrimitiveRenderMode = ESceneCapturePrimitiveRenderMode::PRM_UseShowOnlyList;
+      SceneCapture->CaptureScene();
+
+      FComfyTexturesImageData ObjectDepth;
+      if (!ReadRenderTargetPixels(RenderTarget, EComfyTexturesRenderTextureMode::RawDepth, RawDepthDownsample, ObjectDepth))
+      {
+        UE_LOG(LogComfyTextures, Error, TEXT("Failed to read render target pixels."));
+        return false;
+      }
+
+      CreateEditMaskFromDepth(Output.RawDepth, ObjectDepth, Output.EditMask);
+
+      SceneCapture->PrimitiveRenderMode = ESceneCapturePrimitiveRenderMode::PRM_RenderScenePrimitives;
+    }
+
     SceneCapture->CaptureSource = ESceneCaptureSource::SCS_BaseColor;
     SceneCapture->CaptureScene();
 
-    if (!ReadRenderTargetPixels(RenderTarget, EComfyTexturesRenderTextureMode::Color, Output.Color))
+    if (!ReadRenderTargetPixels(RenderTarget, EComfyTexturesRenderTextureMode::Color, Downsample, Output.Color))
     {
       UE_LOG(LogComfyTextures, Error, TEXT("Failed to read render target pixels."));
       return false;
@@ -2685,7 +4423,7 @@ bool UComfyTexturesWidgetBase::CaptureSceneTextures(UWorld* World, TArray<AActor
     SceneCapture->CaptureSource = ESceneCaptureSource::SCS_Normal;
     SceneCapture->CaptureScene();
 
-    if (!ReadRenderTargetPixels(RenderTarget, EComfyTexturesRenderTextureMode::Normals, Output.Normals))
+    if (!ReadRenderTargetPixels(RenderTarget, EComfyTexturesRenderTextureMode::Normals, Downsample, Output.Normals))
     {
       UE_LOG(LogComfyTextures, Error, TEXT("Failed to read render target pixels."));
       return false;
@@ -2705,75 +4443,124 @@ bool UComfyTexturesWidgetBase::CaptureSceneTextures(UWorld* World, TArray<AActor
   return true;
 }
 
-void UComfyTexturesWidgetBase::ProcessSceneTextures(const TSharedPtr<TArray<FComfyTexturesCaptureOutput>>& Outputs, EComfyTexturesMode Mode, int TargetSize, TFunction<void()> Callback) const
+// packs depth, edge and mask into the color channels of one image and places normals and color side by side in another
+static void PackUploadImages(FComfyTexturesCaptureOutput& Output)
 {
-  TargetSize = FMath::RoundUpToPowerOfTwo(TargetSize);
+  const FComfyTexturesImageData& Depth = Output.Depth;
+  const FComfyTexturesImageData& EdgeMask = Output.EdgeMask;
+  const FComfyTexturesImageData& EditMask = Output.EditMask;
 
-  AsyncTask(ENamedThreads::AnyBackgroundThreadNormalTask, [this, TargetSize, Outputs, Mode, Callback]()
-    {
-      double StartTime = FPlatformTime::Seconds();
+  FComfyTexturesImageData& Data = Output.PackedData;
+  Data.Width = Depth.Width;
+  Data.Height = Depth.Height;
+  Data.Pixels.SetNumUninitialized(Data.Width * Data.Height);
 
-      for (int Index = 0; Index < Outputs->Num(); Index++)
-      {
-        FComfyTexturesCaptureOutput& Output = (*Outputs)[Index];
+  bool bHasEditMask = EditMask.Pixels.Num() > 0;
 
-        if (Mode == EComfyTexturesMode::Edit)
-        {
-          Output.EditMask.Width = Output.Color.Width;
-          Output.EditMask.Height = Output.Color.Height;
-          CreateEditMaskFromImage(Output.Color.Pixels, Output.EditMask.Pixels);
-          ResizeImage(Output.EditMask, TargetSize, TargetSize);
-        }
+  for (int Y = 0; Y < Data.Height; Y++)
+  {
+    // the edit mask can have a different resolution when it was created from the bake depth
+    int MaskY = bHasEditMask ? Y * EditMask.Height / Data.Height : 0;
 
-        // create the edge mask
-        CreateEdgeMask(Output.Depth, Output.Normals, Output.EdgeMask);
-        ResizeImage(Output.EdgeMask, TargetSize, TargetSize);
+    for (int X = 0; X < Data.Width; X++)
+    {
+      int Index = Y * Data.Width + X;
+      float Mask = bHasEditMask ? EditMask.Pixels[MaskY * EditMask.Width + X * EditMask.Width / Data.Width].R : 0.0f;
+      Data.Pixels[Index] = FLinearColor(Depth.Pixels[Index].R, EdgeMask.Pixels[Index].R, Mask, 1.0f);
+    }
+  }
 
-        ResizeImage(Output.Color, TargetSize, TargetSize);
-        ResizeImage(Output.Depth, TargetSize, TargetSize);
-        ResizeImage(Output.Normals, TargetSize, TargetSize);
-      }
+  const FComfyTexturesImageData& Normals = Output.Normals;
+  const FComfyTexturesImageData& Color = Output.Color;
 
-      double EndTime = FPlatformTime::Seconds();
+  FComfyTexturesImageData& Views = Output.PackedViews;
+  Views.Width = Normals.Width + Color.Width;
+  Views.Height = Normals.Height;
+  Views.Pixels.SetNumUninitialized(Views.Width * Views.Height);
 
-      UE_LOG(LogComfyTextures, Display, TEXT("Processed %d scene textures in %f seconds"), Outputs->Num(), EndTime - StartTime);
+  for (int Y = 0; Y < Views.Height; Y++)
+  {
+    FMemory::Memcpy(&Views.Pixels[Y * Views.Width], &Normals.Pixels[Y * Normals.Width], Normals.Width * sizeof(FLinearColor));
+    FMemory::Memcpy(&Views.Pixels[Y * Views.Width + Normals.Width], &Color.Pixels[Y * Color.Width], Color.Width * sizeof(FLinearColor));
+  }
 
-      AsyncTask(ENamedThreads::GameThread, Callback);
-    });
+  Output.Depth = FComfyTexturesImageData();
+  Output.EdgeMask = FComfyTexturesImageData();
+  Output.EditMask = FComfyTexturesImageData();
+  Output.Normals = FComfyTexturesImageData();
+  Output.Color = FComfyTexturesImageData();
 }
 
-void UComfyTexturesWidgetBase::ResizeImage(FComfyTexturesImageData& Image, int NewWidth, int NewHeight) const
+void UComfyTexturesWidgetBase::ProcessSceneTextures(const TSharedPtr<TArray<FComfyTexturesCaptureOutput>>& Outputs, EComfyTexturesMode Mode, bool bPackUploadImages, TFunction<void()> Callback) const
 {
-  static TArray<FColor> OldPixels;
-  OldPixels.SetNumUninitialized(Image.Width * Image.Height);
+  // snapshot the actor meshes so the actor id images can be built off the game thread
+  TSharedPtr<TArray<FComfyTexturesMeshData>> Meshes = MakeShared<TArray<FComfyTexturesMeshData>>();
+  Meshes->SetNum(ActorSet.Num());
 
-  for (int Y = 0; Y < Image.Height; Y++)
+  for (int Index = 0; Index < ActorSet.Num(); Index++)
   {
-    for (int X = 0; X < Image.Width; X++)
-    {
-      FLinearColor Pixel = Image.Pixels[Y * Image.Width + X];
-      Pixel *= 255.0f;
-      OldPixels[Y * Image.Width + X] = FColor(Pixel.R, Pixel.G, Pixel.B, Pixel.A);
-    }
+    CopyWorldSpaceMeshData(ActorSet[Index], (*Meshes)[Index]);
   }
 
-  TArray<FColor> NewPixels;
-  NewPixels.SetNumUninitialized(NewWidth * NewHeight);
+  double StartTime = FPlatformTime::Seconds();
 
-  FImageUtils::ImageResize(Image.Width, Image.Height, OldPixels, NewWidth, NewHeight, NewPixels, true, false);
+  auto LaunchTask = [](TFunction<void()> Work, const FGraphEventArray* Prerequisites = nullptr)
+    {
+      return FFunctionGraphTask::CreateAndDispatchWhenReady(MoveTemp(Work), TStatId(), Prerequisites, ENamedThreads::AnyBackgroundThreadNormalTask);
+    };
 
-  Image.Width = NewWidth;
-  Image.Height = NewHeight;
-  Image.Pixels.SetNumUninitialized(NewWidth * NewHeight);
+  // every view and image is processed by its own task, the images are resized later while they are encoded for upload
+  FGraphEventArray Events;
 
-  for (int Y = 0; Y < Image.Height; Y++)
+  for (int Index = 0; Index < Outputs->Num(); Index++)
   {
-    for (int X = 0; X < Image.Width; X++)
+    FComfyTexturesCaptureOutput* Output = &(*Outputs)[Index];
+
+    Events.Add(LaunchTask([Outputs, Meshes, Output]()
+      {
+        CreateActorIdImage(*Meshes, Output->ViewMatrix, Output->ProjectionMatrix, Output->RawDepth.Width, Output->RawDepth.Height, Output->ActorIds);
+      }));
+
+    Events.Add(LaunchTask([Outputs, Output]()
+      {
+        Output->DepthPyramid = MakeShared<const ComfyTexturesDepthPyramid>(Output->RawDepth);
+      }));
+
+    // create the edge mask
+    FGraphEventArray MaskEvents;
+    MaskEvents.Add(LaunchTask([this, Outputs, Output]()
+      {
+        CreateEdgeMask(Output->Depth, Output->Normals, Output->EdgeMask);
+      }));
+
+    // object masks are created during capture, texture masks are painted into the color
+    if (Mode == EComfyTexturesMode::Edit && Output->EditMask.Pixels.Num() == 0)
+    {
+      MaskEvents.Add(LaunchTask([this, Outputs, Output]()
+        {
+          Output->EditMask.Width = Output->Color.Width;
+          Output->EditMask.Height = Output->Color.Height;
+          CreateEditMaskFromImage(Output->Color.Pixels, Output->EditMask.Pixels);
+        }));
+    }
+
+    if (bPackUploadImages)
+    {
+      Events.Add(LaunchTask([Outputs, Output]() { PackUploadImages(*Output); }, &MaskEvents));
+    }
+    else
     {
-      FColor Pixel = NewPixels[Y * Image.Width + X];
-      FLinearColor NewPixel = FLinearColor(Pixel.R, Pixel.G, Pixel.B, Pixel.A);
-      NewPixel /= 255.0f;
-      Image.Pixels[Y * Image.Width + X] = NewPixel;
+      Events.Append(MaskEvents);
     }
   }
+
+  // join all tasks before handing the results back to the game thread
+  LaunchTask([Outputs, StartTime, Callback]()
+    {
+      double EndTime = FPlatformTime::Seconds();
+
+      UE_LOG(LogComfyTextures, Display, TEXT("Processed %d scene textures in %f seconds"), Outputs->Num(), EndTime - StartTime);
+
+      AsyncTask(ENamedThreads::GameThread, Callback);
+    }, &Events);
 }
@@ -11,6 +11,8 @@
 
 DECLARE_LOG_CATEGORY_EXTERN(LogComfyTextures, Log, All);
 
+class ComfyTexturesDepthPyramid;
+
 UENUM(BlueprintType)
 enum class EComfyTexturesState : uint8
 {
@@ -58,7 +60,44 @@ UENUM(BlueprintType)
 enum class EComfyTexturesCameraMode : uint8
 {
   EditorCamera,
-  ExistingCamera
+  ExistingCamera,
+  MultipleCameras,
+  OrbitCameras,
+  CubeCameras
+};
+
+UENUM(BlueprintType)
+enum class EComfyTexturesPngCompression : uint8
+{
+  Store,
+  Fast,
+  Default
+};
+
+UENUM(BlueprintType)
+enum class EComfyTexturesUploadCodec : uint8
+{
+  Automatic,
+  Png,
+  Tga,
+  Qoi
+};
+
+UENUM(BlueprintType)
+enum class EComfyTexturesEncodeProfile : uint8
+{
+  Color,
+  Data,
+  Mask
+};
+
+UENUM(BlueprintType)
+enum class EComfyTexturesUploadFormat : uint8
+{
+  Rgba8,
+  Rgb8,
+  Gray8,
+  Gray16
 };
 
 UCLASS(config = Game, defaultconfig)
@@ -87,6 +126,42 @@ class UComfyTexturesSettings : public UObject
 
   UPROPERTY(EditAnywhere, config, Category = "General", meta = (DisplayName = "Upload Size", ToolTip = "Size of images uploaded to ComfyUI as workflow inputs"))
   int UploadSize = 1024;
+
+  UPROPERTY(EditAnywhere, config, Category = "General", meta = (DisplayName = "Capture At Upload Size", ToolTip = "Capture at the upload size times the supersample factor instead of the capture size"))
+  bool bCaptureAtUploadSize = false;
+
+  UPROPERTY(EditAnywhere, config, Category = "General", meta = (DisplayName = "Capture Supersample Factor", ToolTip = "Supersampling used when capturing at upload size, captures are downsampled while they are read back", ClampMin = 1, ClampMax = 4))
+  int CaptureSupersampleFactor = 2;
+
+  UPROPERTY(EditAnywhere, config, Category = "General", meta = (DisplayName = "Full Resolution Bake Depth", ToolTip = "Keep the depth used for baking at the supersampled capture resolution"))
+  bool bFullResolutionBakeDepth = false;
+
+  UPROPERTY(EditAnywhere, config, Category = "General", meta = (DisplayName = "Crop Capture To Actors", ToolTip = "Crop the scene capture to the screen bounds of the selected actors so they cover more of the uploaded images"))
+  bool bCropCaptureToActors = true;
+
+  UPROPERTY(EditAnywhere, config, Category = "General", meta = (DisplayName = "Capture Crop Margin", ToolTip = "Margin around the cropped actors as a fraction of their screen size"))
+  float CaptureCropMargin = 0.1f;
+
+  UPROPERTY(EditAnywhere, config, Category = "General", meta = (DisplayName = "Bake Gutter Width", ToolTip = "Texels the baked texture islands are extended by to hide seams between UV islands", ClampMin = 0, ClampMax = 64))
+  int BakeGutterWidth = 4;
+
+  UPROPERTY(EditAnywhere, config, Category = "General", meta = (DisplayName = "Upload Codec", ToolTip = "File format of uploaded images, automatic picks uncompressed TGA, QOI or PNG from the uncompressed pixel throughput measured over the transfer time of each batch of concurrent uploads"))
+  EComfyTexturesUploadCodec UploadCodec = EComfyTexturesUploadCodec::Automatic;
+
+  UPROPERTY(EditAnywhere, config, Category = "General", meta = (DisplayName = "PNG Compression", ToolTip = "Compression of images uploaded to ComfyUI, store or fast are quicker for a local server"))
+  EComfyTexturesPngCompression PngCompression = EComfyTexturesPngCompression::Fast;
+
+  UPROPERTY(EditAnywhere, config, Category = "General", meta = (DisplayName = "Upload 16 Bit Depth", ToolTip = "Upload depth as a 16 bit grayscale PNG, the workflow has to load it with a node that keeps 16 bit images, packed upload images always store depth with 8 bits"))
+  bool bUpload16BitDepth = false;
+
+  UPROPERTY(EditAnywhere, config, Category = "General", meta = (DisplayName = "Pack Upload Images", ToolTip = "Upload two images per view instead of five, depth, edge and mask share one image and normals and color are placed side by side in another"))
+  bool bPackUploadImages = false;
+
+  UPROPERTY(EditAnywhere, config, Category = "General", meta = (DisplayName = "Resize Output To Texture", ToolTip = "Downscale the workflow output to the resolution the actor textures need in each view before it is downloaded"))
+  bool bResizeOutputToTexture = true;
+
+  UPROPERTY(EditAnywhere, config, Category = "General", meta = (DisplayName = "Preview Bake", ToolTip = "Show a quarter resolution bake of the results on the actors while the full resolution bake is running"))
+  bool bPreviewBake = true;
 };
 
 USTRUCT(BlueprintType)
@@ -104,6 +179,30 @@ struct FComfyTexturesImageData
   int Height = 0;
 };
 
+// image queued for upload with the file name, pixel format and quantization it is encoded with
+struct FComfyTexturesUploadImage
+{
+  FComfyTexturesImageData Image;
+
+  FString FileName;
+
+  EComfyTexturesUploadFormat Format = EComfyTexturesUploadFormat::Rgba8;
+
+  // gamma corrected color, linear data or a binary mask
+  EComfyTexturesEncodeProfile Profile = EComfyTexturesEncodeProfile::Color;
+
+  // profiles of equally wide views placed side by side, empty when the whole image uses Profile
+  TArray<EComfyTexturesEncodeProfile> PanelProfiles;
+};
+
+// world space triangles of a selected actor, used to find which actor covers each captured pixel
+struct FComfyTexturesMeshData
+{
+  TArray<uint32> Indices;
+
+  TArray<FVector> Vertices;
+};
+
 USTRUCT(BlueprintType)
 struct FComfyTexturesRenderData
 {
@@ -130,9 +229,14 @@ struct FComfyTexturesRenderData
 
   FMatrix ProjectionMatrix;
 
-  TArray<FColor> OutputPixels;
+  // decoded render result as BGRA8 bytes, which is the memory layout of FColor
+  TArray64<uint8> OutputPixels;
 
-  FComfyTexturesImageData RawDepth;
+  // closest depth of the capture the bake tests occlusion against, shared by every actor
+  TSharedPtr<const ComfyTexturesDepthPyramid> DepthPyramid;
+
+  // index of the closest selected actor for each depth pixel, MAX_uint16 where there is none
+  TArray<uint16> ActorIds;
 
   int OutputWidth = 0;
 
@@ -196,6 +300,22 @@ struct FComfyTexturesRenderOptions
   UPROPERTY(BlueprintReadWrite)
   ACameraActor* ExistingCamera;
 
+  // cameras used in MultipleCameras mode
+  UPROPERTY(BlueprintReadWrite)
+  TArray<ACameraActor*> ExistingCameras;
+
+  // number of views around each orbit ring in OrbitCameras mode
+  UPROPERTY(BlueprintReadWrite)
+  int OrbitViewsPerRing = 4;
+
+  // number of rings stacked between -OrbitPitch and +OrbitPitch in OrbitCameras mode
+  UPROPERTY(BlueprintReadWrite)
+  int OrbitRingCount = 1;
+
+  // camera pitch in degrees for the orbit rings
+  UPROPERTY(BlueprintReadWrite)
+  float OrbitPitch = 30.0f;
+
   UPROPERTY(BlueprintReadWrite)
   bool bPreserveExisting;
 
@@ -211,6 +331,17 @@ struct FComfyTexturesRenderOptions
   FString MaskImageFilename;
 
   FString EdgeMaskImageFilename;
+
+  // set instead of the per image filenames when the upload images are packed
+  FString PackedDataImageFilename;
+
+  FString PackedViewsImageFilename;
+
+  // height of the packed images and width of each view in the packed views image
+  int PackedViewSize = 0;
+
+  // size the workflow output is scaled to before it is saved, 0 keeps the workflow output size
+  int OutputSize = 0;
 };
 
 USTRUCT(BlueprintType)
@@ -235,6 +366,25 @@ struct FComfyTexturesCaptureOutput
 
   UPROPERTY(BlueprintReadOnly)
   FComfyTexturesImageData EdgeMask;
+
+  // depth, edge and mask in the color channels of one image, only used when uploads are packed
+  UPROPERTY(BlueprintReadOnly)
+  FComfyTexturesImageData PackedData;
+
+  // normals and color side by side, only used when uploads are packed
+  UPROPERTY(BlueprintReadOnly)
+  FComfyTexturesImageData PackedViews;
+
+  // matrices the capture was rendered with, including any crop
+  FMatrix ViewMatrix;
+
+  FMatrix ProjectionMatrix;
+
+  // index of the closest selected actor for each RawDepth pixel
+  TArray<uint16> ActorIds;
+
+  // RawDepth as a single channel with a min max pyramid, built after capture
+  TSharedPtr<const ComfyTexturesDepthPyramid> DepthPyramid;
 };
 
 USTRUCT(BlueprintType)
@@ -347,6 +497,12 @@ class COMFYTEXTURES_API UComfyTexturesWidgetBase : public UEditorUtilityWidget
   // next request index to use
   int NextRequestIndex = 0;
 
+  // captured views that are still being uploaded and have not been queued yet
+  int NumPendingUploads = 0;
+
+  // smoothed throughput of whole upload batches in uncompressed pixel bytes per second of transfer, zero until the first batch finished
+  mutable double UploadThroughput = 0.0;
+
   // actors that are currently being processed
   TArray<AActor*> ActorSet;
 
@@ -362,21 +518,33 @@ class COMFYTEXTURES_API UComfyTexturesWidgetBase : public UEditorUtilityWidget
 
   void HandleWebSocketMessage(const TSharedPtr<FJsonObject>& Message);
 
-  bool CreateCameraTransforms(AActor* Actor, const FComfyTexturesRenderOptions& RenderOpts, TArray<FMinimalViewInfo>& OutViewInfos) const;
+  bool CreateCameraTransforms(const TArray<AActor*>& Actors, const FComfyTexturesRenderOptions& RenderOpts, TArray<FMinimalViewInfo>& OutViewInfos) const;
+
+  bool CreateCameraViewInfo(ACameraActor* Camera, FMinimalViewInfo& OutViewInfo) const;
+
+  void CreateEditorCameraViewInfo(FMinimalViewInfo& OutViewInfo) const;
+
+  void CreateRigViewInfos(const FBox& Bounds, const TArray<FRotator>& Rotations, TArray<FMinimalViewInfo>& OutViewInfos) const;
+
+  bool CaptureSceneTextures(UWorld* World, TArray<AActor*> Actors, const TArray<FMinimalViewInfo>& ViewInfos, EComfyTexturesMode Mode, EComfyTexturesEditMaskMode EditMaskMode, const TSharedPtr<TArray<FComfyTexturesCaptureOutput>>& Outputs) const;
 
-  bool CaptureSceneTextures(UWorld* World, TArray<AActor*> Actors, const TArray<FMinimalViewInfo>& ViewInfos, EComfyTexturesMode Mode, const TSharedPtr<TArray<FComfyTexturesCaptureOutput>>& Outputs) const;
+  void ProcessSceneTextures(const TSharedPtr<TArray<FComfyTexturesCaptureOutput>>& Outputs, EComfyTexturesMode Mode, bool bPackUploadImages, TFunction<void()> Callback) const;
 
-  void ProcessSceneTextures(const TSharedPtr<TArray<FComfyTexturesCaptureOutput>>& Outputs, EComfyTexturesMode Mode, int TargetSize, TFunction<void()> Callback) const;
+  bool ReadRenderTargetPixels(UTextureRenderTarget2D* InputTexture, EComfyTexturesRenderTextureMode Mode, int Downsample, FComfyTexturesImageData& OutImage) const;
 
-  bool ReadRenderTargetPixels(UTextureRenderTarget2D* InputTexture, EComfyTexturesRenderTextureMode Mode, FComfyTexturesImageData& OutImage) const;
+  bool EncodeUploadImage(const FComfyTexturesUploadImage& Upload, EComfyTexturesUploadCodec Codec, int Width, int Height, TArray64<uint8>& OutBytes) const;
 
-  bool ConvertImageToPng(const FComfyTexturesImageData& Image, TArray64<uint8>& OutBytes) const;
+  EComfyTexturesUploadCodec SelectUploadCodec() const;
 
-  bool UploadImages(const TArray<FComfyTexturesImageData>& Images, const TArray<FString>& FileNames, TFunction<void(const TArray<FString>&, bool)> Callback) const;
+  bool UploadImages(TArray<FComfyTexturesUploadImage> Images, int TargetSize, TFunction<void(const TArray<FString>&, bool)> Callback) const;
 
-  bool DownloadImage(const FString& FileName, TFunction<void(TArray<FColor>, int, int, bool)> Callback) const;
+  bool DownloadImage(const FString& FileName, TFunction<void(TArray64<uint8>, int, int, bool)> Callback) const;
 
-  bool CalculateApproximateScreenBounds(AActor* Actor, const FMinimalViewInfo& ViewInfo, FBox2D& OutBounds) const;
+  bool CalculateApproximateScreenBounds(AActor* Actor, const FMinimalViewInfo& ViewInfo, FBox2D& OutBounds, bool bRejectBehindCamera = false) const;
+
+  bool CalculateCaptureCropBounds(const TArray<AActor*>& Actors, const FMinimalViewInfo& ViewInfo, float Margin, FBox2D& OutBounds) const;
+
+  int CalculateRequiredOutputSize(const TArray<AActor*>& Actors, const FMatrix& ViewProjectionMatrix, int MaxSize) const;
 
   UTexture2D* CreateTexture2D(int Width, int Height, const TArray<FColor>& Pixels) const;
 
@@ -384,11 +552,11 @@ class COMFYTEXTURES_API UComfyTexturesWidgetBase : public UEditorUtilityWidget
 
   void CreateEditMaskFromImage(const TArray<FLinearColor>& Pixels, TArray<FLinearColor>& OutPixels) const;
 
+  void CreateEditMaskFromDepth(const FComfyTexturesImageData& SceneDepth, const FComfyTexturesImageData& ObjectDepth, FComfyTexturesImageData& OutEditMask) const;
+
   void CreateEdgeMask(const FComfyTexturesImageData& Depth, const FComfyTexturesImageData& Normals, FComfyTexturesImageData& OutEdgeMask) const;
 
   void LoadRenderResultImages(TFunction<void(bool)> Callback);
 
   void TransitionToIdleState();
-
-  void ResizeImage(FComfyTexturesImageData& Image, int NewWidth, int NewHeight) const;
 };